@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+
+static cpu_set_t policy_cpus; // set -o affinity=LIST
+static int policy_set;
+static int policy_spread;
+
+// what the next child applies, worked out in the shell just before fork
+static cpu_set_t job_cpus, stage_cpus;
+static int job_pinned, stage_pinned;
+static int job_node = -1;
+static int job_stages;
+static int stage_base; // spread: where this job's first stage goes
+
+static int spread_next; // spread: rotates so jobs do not pile up on one core
+
+/*
+ *  "0-7,16,18-19" into set, -1 if malformed
+ */
+
+static int
+cpulist_to_set(const char *list, cpu_set_t *set)
+{
+    const char *s = list;
+    char *end;
+
+    CPU_ZERO(set);
+    if(!*s)
+        return -1;
+
+    while(*s)
+    {
+        long lo = strtol(s, &end, 10), hi;
+        if(end == s || lo < 0)
+            return -1;
+        hi = lo;
+        s = end;
+        if(*s == '-')
+        {
+            hi = strtol(s + 1, &end, 10);
+            if(end == s + 1 || hi < lo)
+                return -1;
+            s = end;
+        }
+        if(hi >= CPU_SETSIZE)
+            return -1;
+        for(long c = lo; c <= hi; c++)
+            CPU_SET(c, set);
+        if(*s == ',')
+            s++;
+        else if(*s && *s != '\n')
+            return -1;
+        else
+            break;
+    }
+
+    return 0;
+}
+
+static int
+read_cpulist(const char *path, cpu_set_t *set)
+{
+    char buf[4096];
+    FILE *f = fopen(path, "re");
+
+    if(f == NULL)
+        return -1;
+    if(!fgets(buf, sizeof(buf), f))
+        buf[0] = '\0';
+    fclose(f);
+
+    return cpulist_to_set(buf, set);
+}
+
+int
+set_affinity(char *value)
+{
+    cpu_set_t cpus;
+
+    if(value == NULL)
+    {
+        policy_set = 0;
+        policy_spread = 0;
+        return 0;
+    }
+
+    // a bad list leaves whatever policy was set before in place
+    if(!strcmp(value, "spread"))
+    {
+        policy_set = 0;
+        policy_spread = 1;
+    }
+    else if(cpulist_to_set(value, &cpus) == 0)
+    {
+        policy_cpus = cpus;
+        policy_set = 1;
+        policy_spread = 0;
+    }
+    else
+    {
+        fprintf(stderr, "set: affinity: %s: not a cpu list or spread\n", value);
+        return 1 << 8;
+    }
+
+    return 0;
+}
+
+/*
+ *  Spread order: every allowed CPU, sorted by the last level cache it
+ *  sits behind, then by its L2. Consecutive entries share as much cache
+ *  as the machine offers, so consecutive stages go there.
+ */
+
+typedef struct CpuKey
+{
+    int cpu, llc, l2;
+} CpuKey;
+
+static int
+first_cpu_sharing(int cpu, int level)
+{
+    char path[128];
+    cpu_set_t set;
+    int best = -1, best_level = 0;
+
+    for(int index = 0; index < 8; index++)
+    {
+        char buf[16];
+        FILE *f;
+        int lvl;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+        if(!(f = fopen(path, "re")))
+            break;
+        lvl = fgets(buf, sizeof(buf), f) ? atoi(buf) : 0;
+        fclose(f);
+
+        // level 0 asks for the last level
+        if((level && lvl != level) || (!level && lvl <= best_level))
+            continue;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+        if(read_cpulist(path, &set) < 0)
+            continue;
+        for(int c = 0; c < CPU_SETSIZE; c++)
+            if(CPU_ISSET(c, &set))
+            {
+                best = c;
+                break;
+            }
+        best_level = lvl;
+    }
+
+    return best < 0 ? cpu : best;
+}
+
+static int
+compare_keys(const void *a, const void *b)
+{
+    const CpuKey *x = a, *y = b;
+
+    if(x->llc != y->llc)
+        return x->llc - y->llc;
+    if(x->l2 != y->l2)
+        return x->l2 - y->l2;
+    return x->cpu - y->cpu;
+}
+
+static CpuKey *spread_order;
+static int spread_len;
+
+static void
+build_spread_order()
+{
+    spread_order = malloc(sizeof(CpuKey) * CPU_SETSIZE);
+    spread_len = 0;
+
+    for(int c = 0; c < CPU_SETSIZE; c++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", c);
+        if(access(path, F_OK) < 0)
+            continue;
+        spread_order[spread_len].cpu = c;
+        spread_order[spread_len].llc = first_cpu_sharing(c, 0);
+        spread_order[spread_len].l2 = first_cpu_sharing(c, 2);
+        spread_len++;
+    }
+
+    qsort(spread_order, spread_len, sizeof(CpuKey), compare_keys);
+}
+
+void
+affinity_begin(job *j)
+{
+    cpu_set_t allowed;
+
+    job_pinned = 0;
+    job_node = j->node;
+    job_stages = 0;
+    for(process *p = j->first_process; p; p = p->next)
+        job_stages++;
+
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return;
+    job_cpus = allowed;
+
+    if(j->cpus)
+    {
+        cpu_set_t want;
+        if(cpulist_to_set(j->cpus, &want) < 0)
+            fprintf(stderr, "@cpus=%s: not a cpu list, ignored\n", j->cpus);
+        else
+        {
+            CPU_AND(&job_cpus, &job_cpus, &want);
+            job_pinned = 1;
+        }
+    }
+    else if(policy_set)
+    {
+        CPU_AND(&job_cpus, &job_cpus, &policy_cpus);
+        job_pinned = 1;
+    }
+
+    if(j->node >= 0)
+    {
+        char path[64];
+        cpu_set_t node;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", j->node);
+        if(read_cpulist(path, &node) < 0)
+        {
+            fprintf(stderr, "@node=%d: no such node, ignored\n", j->node);
+            job_node = -1;
+        }
+        else
+        {
+            CPU_AND(&job_cpus, &job_cpus, &node);
+            job_pinned = 1;
+        }
+    }
+
+    if(job_pinned && CPU_COUNT(&job_cpus) == 0)
+    {
+        fprintf(stderr, "no allowed cpu left for this job, not pinned\n");
+        job_pinned = 0;
+    }
+
+    if(!policy_spread || job_stages < 2)
+        return;
+
+    if(spread_order == NULL)
+        build_spread_order();
+
+    // start where the next job_stages usable CPUs stay behind one cache if possible
+    int usable = 0;
+    for(int i = 0; i < spread_len; i++)
+        usable += CPU_ISSET(spread_order[i].cpu, &job_cpus);
+    if(usable == 0)
+        return;
+
+    stage_base = spread_next % spread_len;
+    for(int tries = 0; tries < spread_len; tries++)
+    {
+        int i = (stage_base + tries) % spread_len, run = 0;
+
+        if(!CPU_ISSET(spread_order[i].cpu, &job_cpus))
+            continue;
+        for(int k = i; k < spread_len && spread_order[k].llc == spread_order[i].llc; k++)
+            run += CPU_ISSET(spread_order[k].cpu, &job_cpus);
+        if(run >= job_stages || run == usable)
+        {
+            stage_base = i;
+            break;
+        }
+    }
+    spread_next = stage_base + job_stages;
+}
+
+void
+affinity_stage(int stage)
+{
+    stage_cpus = job_cpus;
+    stage_pinned = job_pinned;
+
+    if(!policy_spread || job_stages < 2 || spread_len == 0)
+        return;
+
+    // the stage-th usable CPU from stage_base, wrapping
+    for(int i = stage_base, seen = 0, n = 0; n < spread_len * 2; i = (i + 1) % spread_len, n++)
+        if(CPU_ISSET(spread_order[i].cpu, &job_cpus) && seen++ == stage % CPU_COUNT(&job_cpus))
+        {
+            CPU_ZERO(&stage_cpus);
+            CPU_SET(spread_order[i].cpu, &stage_cpus);
+            stage_pinned = 1;
+            return;
+        }
+}
+
+void
+affinity_apply()
+{
+    if(stage_pinned && sched_setaffinity(0, sizeof(stage_cpus), &stage_cpus) < 0)
+        perror("sched_setaffinity");
+
+    if(job_node >= 0)
+    {
+        unsigned long mask[16] = {0}; // nodes 0-1023
+
+        if(job_node >= (int)(sizeof(mask) * 8))
+            return;
+        mask[job_node / (8 * sizeof(long))] |= 1UL << (job_node % (8 * sizeof(long)));
+        if(syscall(SYS_set_mempolicy, MPOL_BIND, mask, sizeof(mask) * 8) < 0 && errno != ENOSYS)
+            perror("set_mempolicy");
+    }
+}
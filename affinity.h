@@ -0,0 +1,25 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include "jobcontrol.h"
+
+/*
+ *  CPU and memory placement of jobs.
+ *
+ *      @cpus=0-7,16 cmd | cmd2   run every stage on those CPUs
+ *      @node=1 cmd               run on node 1's CPUs, allocate from node 1
+ *      set -o affinity=0-7       the same for every job without @cpus
+ *      set -o affinity=spread    one CPU per pipeline stage, neighbouring
+ *                                stages on CPUs that share a cache
+ *
+ *  The shell works out each stage's CPUs before forking it, the child
+ *  applies them with sched_setaffinity and set_mempolicy before exec.
+ */
+
+int set_affinity(char *value);
+
+void affinity_begin(job *j);
+void affinity_stage(int stage);
+void affinity_apply();
+
+#endif
@@ -0,0 +1,226 @@
+#define _POSIX_C_SOURCE 200809L
+#include "parse_drive.h"
+#include "my_shell.h"
+#include "stats.h"
+#include "scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ *  Parser microbenchmark: parse_sep -> parse_logic -> parse_job over
+ *  corpora of command lines, with nothing executed.
+ *
+ *  usage: parse_bench [-i iterations] [-s size] [CORPUS...]
+ *
+ *  Every CORPUS file is parsed line by line. Without files, generated
+ *  corpora are parsed at size s and 4s. The growth column is the ratio
+ *  of their ns/byte: about 1 for a linear stage, about 4 for a
+ *  quadratic one.
+ */
+
+typedef struct corpus
+{
+    char name[64];
+    char **lines;
+    int num_lines;
+    long bytes;
+} corpus;
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+add_line(corpus *c, char *line)
+{
+    c->lines = realloc(c->lines, sizeof(char *) * (c->num_lines + 1));
+    c->lines[c->num_lines++] = line; // ownership moved
+    c->bytes += strlen(line);
+}
+
+static void
+free_corpus(corpus *c)
+{
+    for(int i = 0; i < c->num_lines; i++)
+        free(c->lines[i]);
+    free(c->lines);
+}
+
+static int
+load_corpus(corpus *c, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+
+    if(!f)
+    {
+        perror(path);
+        return -1;
+    }
+
+    memset(c, 0, sizeof(corpus));
+    snprintf(c->name, sizeof(c->name), "%s", path);
+
+    while((len = getline(&line, &cap, f)) > 0)
+    {
+        if(line[len - 1] == '\n')
+            line[len - 1] = '\0';
+        add_line(c, strdup(line));
+    }
+
+    free(line);
+    fclose(f);
+    return 0;
+}
+
+/*
+ *  Generated single-line inputs of n units each
+ */
+
+typedef struct generator
+{
+    char *name;
+    char *head, *unit, *tail;
+} generator;
+
+static generator generators[] = {
+    {"words",      "echo",       " word",  ""},
+    {"long-words", "echo",       " /usr/share/doc/package-name/README.Debian", ""},
+    {"long-quote", "echo '",     "a long single quoted string ", "'"},
+    {"pipeline",   "true",       " | cat", ""},
+    {"separators", "",           "true; ", "true"},
+    {"and-or",     "true",       " && true || false", ""},
+    {"parens",     "",           "(",      "echo x"}, // closed below
+    {"quotes",     "echo \"",    "q'q ",   "\""},
+    {"variables",  "echo ",      "$HOME/", ""},
+    {"redirs",     "cat",        " >o",    ""},
+    {NULL, NULL, NULL, NULL}
+};
+
+static void
+generate(corpus *c, generator *g, int n)
+{
+    size_t unit_len = strlen(g->unit);
+    size_t size = strlen(g->head) + n * unit_len + strlen(g->tail) + n + 1;
+    char *line = malloc(size);
+    char *p = line;
+
+    p += sprintf(p, "%s", g->head);
+    for(int i = 0; i < n; i++, p += unit_len)
+        memcpy(p, g->unit, unit_len);
+    p += sprintf(p, "%s", g->tail);
+    if(g->unit[0] == '(')
+        for(int i = 0; i < n; i++)
+            *p++ = ')';
+    *p = '\0';
+
+    memset(c, 0, sizeof(corpus));
+    snprintf(c->name, sizeof(c->name), "%s x%d", g->name, n);
+    add_line(c, line);
+}
+
+typedef struct result
+{
+    double mb_per_s;
+    double ns_per_byte;
+    double allocs_per_line;
+} result;
+
+static result
+measure(corpus *c, int iterations)
+{
+    uint64_t allocs = shell_stats->allocs;
+    double start = now();
+    result r;
+
+    for(int it = 0; it < iterations; it++)
+        for(int i = 0; i < c->num_lines; i++)
+            parse_line(c->lines[i]);
+
+    double t = now() - start;
+    double bytes = (double)c->bytes * iterations;
+
+    r.mb_per_s = bytes / t / (1024 * 1024);
+    r.ns_per_byte = t * 1e9 / bytes;
+    r.allocs_per_line = (double)(shell_stats->allocs - allocs) / ((double)c->num_lines * iterations);
+    return r;
+}
+
+static void
+print_result(corpus *c, result *r)
+{
+    printf("%-28s %8d %10ld %9.2f %9.2f %12.1f", c->name, c->num_lines, c->bytes,
+           r->mb_per_s, r->ns_per_byte, r->allocs_per_line);
+}
+
+int
+main(int argc, char **argv)
+{
+    int iterations = 20;
+    int size = 1000;
+    int opt;
+
+    while((opt = getopt(argc, argv, "i:s:")) != -1)
+    {
+        if(opt == 'i')
+            iterations = atoi(optarg);
+        else if(opt == 's')
+            size = atoi(optarg);
+        else
+        {
+            fprintf(stderr, "usage: %s [-i iterations] [-s size] [CORPUS...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    init_environ(); // $VAR expansion looks up the environment
+    scan_init();
+
+    printf("%-28s %8s %10s %9s %9s %12s %7s\n",
+           "corpus", "lines", "bytes", "MB/s", "ns/byte", "allocs/line", "growth");
+
+    for(int i = optind; i < argc; i++)
+    {
+        corpus c;
+        if(load_corpus(&c, argv[i]) < 0)
+            continue;
+
+        result r = measure(&c, iterations);
+        print_result(&c, &r);
+        printf("\n");
+        free_corpus(&c);
+    }
+
+    if(optind < argc)
+        return 0;
+
+    for(generator *g = generators; g->name; g++)
+    {
+        corpus small, large;
+
+        generate(&small, g, size);
+        generate(&large, g, size * 4);
+
+        result rs = measure(&small, iterations);
+        result rl = measure(&large, iterations);
+
+        print_result(&small, &rs);
+        printf("\n");
+        print_result(&large, &rl);
+        printf(" %7.2f\n", rl.ns_per_byte / rs.ns_per_byte);
+
+        free_corpus(&small);
+        free_corpus(&large);
+    }
+
+    return 0;
+}
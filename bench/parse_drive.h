@@ -0,0 +1,28 @@
+#ifndef PARSE_DRIVE_H
+#define PARSE_DRIVE_H
+
+#include "parser.h"
+#include "jobcontrol.h"
+
+/*
+ *  Run one command line through every parser stage the shell uses,
+ *  parse_sep -> parse_logic -> parse_job, without executing anything.
+ */
+
+static void
+parse_line(char *line)
+{
+    SepNode *sep = parse_sep(line);
+
+    for(SepNode *s = sep; s; s = s->next)
+    {
+        LogicNode *logic = parse_logic(s->cmd);
+        for(LogicNode *l = logic; l; l = l->next)
+            freejob(parse_job(l->cmd));
+        free_logic_list(logic);
+    }
+
+    free_sep_list(sep);
+}
+
+#endif
@@ -0,0 +1,73 @@
+#include "parse_drive.h"
+#include "my_shell.h"
+#include "scan.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ *  libFuzzer target for the parser (make fuzz). Run with a small
+ *  -timeout so inputs that make a stage quadratic are reported as
+ *  slow units, not only crashes.
+ *
+ *  Built with -DFUZZ_REPLAY it gets its own main that replays the
+ *  files given on the command line, for compilers without libFuzzer.
+ */
+
+int
+LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    (void)argc;
+    (void)argv;
+    init_environ();
+    scan_init();
+    return 0;
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    char *line = malloc(size + 1);
+
+    memcpy(line, data, size);
+    line[size] = '\0'; // anything after an embedded NUL is ignored like the shell does
+
+    parse_line(line);
+    free(line);
+    return 0;
+}
+
+#ifdef FUZZ_REPLAY
+
+int
+main(int argc, char **argv)
+{
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    for(int i = 1; i < argc; i++)
+    {
+        FILE *f = fopen(argv[i], "rb");
+        if(!f)
+        {
+            perror(argv[i]);
+            continue;
+        }
+
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        rewind(f);
+
+        uint8_t *data = malloc(size > 0 ? size : 1);
+        size = fread(data, 1, size, f);
+        fclose(f);
+
+        LLVMFuzzerTestOneInput(data, size);
+        free(data);
+        printf("%s: ok\n", argv[i]);
+    }
+
+    return 0;
+}
+
+#endif
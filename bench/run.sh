@@ -0,0 +1,143 @@
+#!/bin/sh
+#
+#  Benchmark suite: myshell next to dash and bash on the same machine.
+#
+#  usage: bench/run.sh [path/to/myshell]
+#
+#  Knobs (environment): N (commands per workload), STAGES (pipeline
+#  length), MB (pipeline payload), REPEAT (parse corpus repetitions).
+#
+
+MYSHELL=${1:-./myshell-release}
+BENCH=$(dirname "$0")
+N=${N:-1000}
+STAGES=${STAGES:-4}
+MB=${MB:-512}
+REPEAT=${REPEAT:-2000}
+TMP=${TMPDIR:-/tmp}/myshell-bench.$$
+
+mkdir -p "$TMP"
+trap 'rm -rf "$TMP"' EXIT
+
+now()
+{
+    date +%s%N
+}
+
+# elapsed seconds since $1 (from now)
+since()
+{
+    echo "$1 $(now)" | awk '{printf "%.6f", ($2 - $1) / 1e9}'
+}
+
+rate()
+{
+    awk -v n="$1" -v t="$2" 'BEGIN { if(t > 0) printf "%.1f", n / t; else print "-" }'
+}
+
+# --- workload scripts ---------------------------------------------------
+
+i=0
+: > "$TMP/forkexec.sh"
+: > "$TMP/bg.sh"
+while [ $i -lt "$N" ]
+do
+    echo "/bin/true" >> "$TMP/forkexec.sh"
+    echo "/bin/true &" >> "$TMP/bg.sh"
+    i=$((i + 1))
+done
+echo "wait" >> "$TMP/bg.sh"
+
+pipeline="head -c $((MB * 1024 * 1024)) /dev/zero"
+i=1
+while [ $i -lt "$STAGES" ]
+do
+    pipeline="$pipeline | cat"
+    i=$((i + 1))
+done
+echo "$pipeline | wc -c > /dev/null" > "$TMP/pipeline.sh"
+
+i=0
+: > "$TMP/corpus.sh"
+while [ $i -lt "$REPEAT" ]
+do
+    cat "$BENCH/corpus.txt" >> "$TMP/corpus.sh"
+    i=$((i + 1))
+done
+corpus_bytes=$(wc -c < "$TMP/corpus.sh")
+
+# --- workloads ----------------------------------------------------------
+
+startup()
+{
+    t=$(now)
+    i=0
+    while [ $i -lt 100 ]
+    do
+        echo exit | $1 > /dev/null 2>&1
+        i=$((i + 1))
+    done
+    awk -v t="$(since "$t")" 'BEGIN { printf "%.3f", t * 1000 / 100 }'
+}
+
+forkexec()
+{
+    t=$(now)
+    $1 < "$TMP/forkexec.sh" > /dev/null 2>&1
+    rate "$N" "$(since "$t")"
+}
+
+pipeline()
+{
+    t=$(now)
+    $1 < "$TMP/pipeline.sh" > /dev/null 2>&1
+    rate "$MB" "$(since "$t")"
+}
+
+bgreap()
+{
+    t=$(now)
+    $1 < "$TMP/bg.sh" > /dev/null 2>&1
+    rate "$N" "$(since "$t")"
+}
+
+# myshell has no parse-only mode, its parser is timed by parse_bench
+parse()
+{
+    if [ "$1" = "$MYSHELL" ]
+    then
+        "$BENCH/parse_bench" -i 1 "$TMP/corpus.sh" | awk 'NR == 2 {print $4}'
+        return
+    fi
+
+    t=$(now)
+    $1 -n < "$TMP/corpus.sh" > /dev/null 2>&1
+    rate "$(awk -v b="$corpus_bytes" 'BEGIN { print b / 1048576 }')" "$(since "$t")"
+}
+
+# --- report -------------------------------------------------------------
+
+shells="$MYSHELL"
+for sh in dash bash
+do
+    command -v $sh > /dev/null && shells="$shells $sh"
+done
+
+printf "%-28s" "workload"
+for sh in $shells
+do
+    printf "%14s" "$(basename "$sh")"
+done
+printf "\n"
+
+for w in "startup:ms/run" "forkexec:cmds/s" "bgreap:jobs/s" "pipeline:MB/s" "parse:MB/s"
+do
+    name=${w%%:*}
+    unit=${w#*:}
+    printf "%-28s" "$name ($unit)"
+    for sh in $shells
+    do
+        printf "%14s" "$($name "$sh")"
+    done
+    printf "\n"
+done
@@ -0,0 +1,423 @@
+#define _GNU_SOURCE
+#include "cache.h"
+#include "my_shell.h"
+#include "jobcontrol.h"
+#include "dynamicstring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*
+ *  cache [--inputs FILE...] [--env NAME...] -- cmd args
+ *
+ *  The key covers argv, the cwd, the named variables and the size, mtime
+ *  and contents of every input. Results live in $XDG_CACHE_HOME/myshell
+ *  (~/.cache/myshell), one directory per key holding out, err and status.
+ *  A directory only appears under its key once complete, by rename.
+ */
+
+/*
+ *  Two 64 bit lanes over 8 byte words, finalized separately. Not a
+ *  cryptographic hash: it tells a deterministic tool's inputs apart, it
+ *  does not resist someone crafting collisions.
+ */
+
+typedef struct Hash
+{
+    uint64_t a, b;
+} Hash;
+
+static inline uint64_t
+rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static void
+hash_bytes(Hash *h, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    uint64_t w;
+
+    for(; len >= 8; p += 8, len -= 8)
+    {
+        memcpy(&w, p, 8);
+        h->a = rotl((h->a ^ w) * 0x9e3779b97f4a7c15ULL, 31);
+        h->b = rotl((h->b + w) * 0xc2b2ae3d27d4eb4fULL, 27) ^ h->a;
+    }
+
+    w = 0;
+    memcpy(&w, p, len);
+    h->a = rotl((h->a ^ w ^ len) * 0x9e3779b97f4a7c15ULL, 31);
+    h->b = rotl((h->b + w) * 0xc2b2ae3d27d4eb4fULL, 27) ^ h->a;
+}
+
+// length first, so ("ab", "c") and ("a", "bc") differ
+static void
+hash_field(Hash *h, const void *data, size_t len)
+{
+    uint64_t n = len;
+
+    hash_bytes(h, &n, sizeof(n));
+    hash_bytes(h, data, len);
+}
+
+static uint64_t
+mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+uint64_t
+cache_hash(const void *data, size_t len)
+{
+    Hash h = {0x243f6a8885a308d3ULL, 0x13198a2e03707344ULL};
+
+    hash_field(&h, data, len);
+    return mix(h.a) ^ mix(h.b);
+}
+
+static int
+hash_input(Hash *h, const char *path)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    hash_field(h, path, strlen(path));
+
+    if(fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(path);
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    int64_t meta[3] = {st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+    hash_bytes(h, meta, sizeof(meta));
+
+    if(st.st_size > 0)
+    {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map == MAP_FAILED)
+        {
+            perror(path);
+            close(fd);
+            return -1;
+        }
+        hash_bytes(h, map, st.st_size);
+        munmap(map, st.st_size);
+    }
+
+    close(fd);
+    return 0;
+}
+
+static void
+hash_env(Hash *h, const char *name)
+{
+    const char *value = find_environ(name, strlen(name));
+
+    hash_field(h, name, strlen(name));
+    if(value)
+        hash_field(h, value, strlen(value));
+    else
+        hash_bytes(h, "", 1); // unset differs from empty
+}
+
+/*
+ *  Creates the store directory on the way
+ */
+
+int
+cache_dir(dystring *ds)
+{
+    const char *xdg = find_environ("XDG_CACHE_HOME", 14);
+    const char *home = find_environ("HOME", 4);
+
+    if(xdg && xdg[0])
+        merge_dystring(ds, xdg);
+    else if(home)
+    {
+        merge_dystring(ds, home);
+        merge_dystring(ds, "/.cache");
+    }
+    else
+        return -1;
+
+    mkdir(ds->string, 0700);
+    merge_dystring(ds, "/myshell");
+    if(mkdir(ds->string, 0700) < 0 && errno != EEXIST)
+    {
+        perror(ds->string);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+copy_fd(int in, int out)
+{
+    char buf[65536];
+    ssize_t n;
+
+    while((n = sendfile(out, in, NULL, 1 << 30)) > 0){}
+    if(n == 0)
+        return;
+
+    // sendfile refuses some outputs (O_APPEND files, some pipes)
+    while((n = read(in, buf, sizeof(buf))) > 0)
+        if(write(out, buf, n) != n)
+            return;
+}
+
+static void
+replay_file(const char *dir, const char *name, int out)
+{
+    dystring path;
+    int fd;
+
+    init_dystring(&path);
+    merge_dystring(&path, dir);
+    append_dystring(&path, '/');
+    merge_dystring(&path, name);
+
+    fd = open(path.string, O_RDONLY | O_CLOEXEC);
+    if(fd >= 0)
+    {
+        copy_fd(fd, out);
+        close(fd);
+    }
+    free_dystring(&path);
+}
+
+/*
+ *  Stored output, then the stored wait status, or -1 for no entry
+ */
+
+static int
+replay(const char *dir)
+{
+    char buf[32];
+    dystring path;
+    ssize_t n;
+    int fd;
+
+    init_dystring(&path);
+    merge_dystring(&path, dir);
+    merge_dystring(&path, "/status");
+    fd = open(path.string, O_RDONLY | O_CLOEXEC);
+    free_dystring(&path);
+    if(fd < 0)
+        return -1;
+
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if(n <= 0)
+        return -1;
+    buf[n] = '\0';
+
+    fflush(stdout);
+    replay_file(dir, "out", STDOUT_FILENO);
+    replay_file(dir, "err", STDERR_FILENO);
+
+    return atoi(buf);
+}
+
+static int
+open_in(const char *dir, const char *name)
+{
+    dystring path;
+    int fd;
+
+    init_dystring(&path);
+    merge_dystring(&path, dir);
+    append_dystring(&path, '/');
+    merge_dystring(&path, name);
+    fd = open(path.string, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd < 0)
+        perror(path.string);
+    free_dystring(&path);
+
+    return fd;
+}
+
+static void
+remove_entry(const char *dir)
+{
+    const char *names[] = {"out", "err", "status"};
+    dystring path;
+
+    init_dystring(&path);
+    for(int i = 0; i < 3; i++)
+    {
+        merge_dystring(&path, dir);
+        append_dystring(&path, '/');
+        merge_dystring(&path, names[i]);
+        unlink(path.string);
+        free_dystring(&path);
+    }
+    rmdir(dir);
+}
+
+/*
+ *  Run cmd as a foreground job with stdout and stderr captured in tmp.
+ *  Returns its wait status, -1 if it did not complete (stopped).
+ */
+
+static int
+run_captured(char **cmd, const char *tmp)
+{
+    int out = open_in(tmp, "out");
+    int err = open_in(tmp, "err");
+    job *j = new_job();
+    process *p = new_process();
+    dystring command;
+    int argc = 0;
+
+    if(out < 0 || err < 0)
+    {
+        if(out >= 0) close(out);
+        if(err >= 0) close(err);
+        freejob(j);
+        free(p);
+        return -1;
+    }
+
+    while(cmd[argc])
+        argc++;
+    p->argv = malloc(sizeof(char *) * (argc + 1));
+    init_dystring(&command);
+    for(int i = 0; i < argc; i++)
+    {
+        p->argv[i] = strdup(cmd[i]);
+        if(i)
+            append_dystring(&command, ' ');
+        merge_dystring(&command, cmd[i]);
+    }
+    p->argv[argc] = NULL;
+    j->command = steal_dystring(&command);
+    j->first_process = p;
+    j->stdout = out;
+    j->stderr = err;
+
+    launch_job(j, 1);
+    int status = p->completed ? j->status : -1;
+
+    close(out);
+    close(err);
+    do_job_notification(); // frees j once completed
+
+    return status;
+}
+
+int
+do_cache(char **argv)
+{
+    Hash h = {0x243f6a8885a308d3ULL, 0x13198a2e03707344ULL};
+    dystring dir, tmp;
+    char cwd[4096];
+    char hex[40];
+    int sep, status;
+    enum { OPT_NONE, OPT_INPUTS, OPT_ENV } mode = OPT_NONE;
+
+    for(sep = 1; argv[sep] && strcmp(argv[sep], "--"); sep++){}
+    if(!argv[sep] || !argv[sep + 1])
+    {
+        fprintf(stderr, "usage: cache [--inputs FILE...] [--env NAME...] -- cmd args\n");
+        return 2 << 8;
+    }
+
+    for(int i = sep + 1; argv[i]; i++)
+        hash_field(&h, argv[i], strlen(argv[i]));
+    if(getcwd(cwd, sizeof(cwd)))
+        hash_field(&h, cwd, strlen(cwd));
+
+    for(int i = 1; i < sep; i++)
+    {
+        if(!strcmp(argv[i], "--inputs"))
+            mode = OPT_INPUTS;
+        else if(!strcmp(argv[i], "--env"))
+            mode = OPT_ENV;
+        else if(mode == OPT_INPUTS)
+        {
+            if(hash_input(&h, argv[i]) < 0)
+                return 1 << 8;
+        }
+        else if(mode == OPT_ENV)
+            hash_env(&h, argv[i]);
+        else
+        {
+            fprintf(stderr, "cache: unknown option %s\n", argv[i]);
+            return 2 << 8;
+        }
+    }
+
+    init_dystring(&dir);
+    init_dystring(&tmp);
+    if(cache_dir(&dir) < 0)
+    {
+        free_dystring(&dir);
+        return 1 << 8;
+    }
+
+    snprintf(hex, sizeof(hex), "/%016llx%016llx",
+             (unsigned long long)mix(h.a), (unsigned long long)mix(h.b ^ h.a));
+    merge_dystring(&dir, hex);
+
+    status = replay(dir.string);
+    if(status < 0)
+    {
+        char suffix[32];
+
+        merge_dystring(&tmp, dir.string);
+        snprintf(suffix, sizeof(suffix), ".tmp.%d", (int)getpid());
+        merge_dystring(&tmp, suffix);
+        mkdir(tmp.string, 0700);
+
+        status = run_captured(&argv[sep + 1], tmp.string);
+
+        // a job killed by a signal (^C) says nothing about its inputs
+        if(status >= 0 && !WIFSIGNALED(status))
+        {
+            char buf[32];
+            int fd = open_in(tmp.string, "status");
+            int len = snprintf(buf, sizeof(buf), "%d\n", status);
+
+            if(fd >= 0 && write(fd, buf, len) == len && rename(tmp.string, dir.string) == 0)
+                status = replay(dir.string);
+            else
+            {
+                status = replay(tmp.string);
+                remove_entry(tmp.string); // another shell stored it first
+            }
+            if(fd >= 0)
+                close(fd);
+        }
+        else
+        {
+            fflush(stdout);
+            replay_file(tmp.string, "out", STDOUT_FILENO);
+            replay_file(tmp.string, "err", STDERR_FILENO);
+            remove_entry(tmp.string);
+        }
+    }
+
+    free_dystring(&dir);
+    free_dystring(&tmp);
+
+    return status < 0 ? 1 << 8 : status;
+}
@@ -0,0 +1,25 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include "dynamicstring.h"
+
+/*
+ *  cache builtin: replay the stored output and status of a command whose
+ *  argv, cwd, selected variables and input files are unchanged, or run
+ *  it and store them.
+ */
+
+int do_cache(char **argv);
+
+/*
+ *  $XDG_CACHE_HOME/myshell (~/.cache/myshell) into ds, created if
+ *  missing. -1 without HOME.
+ */
+
+int cache_dir(dystring *ds);
+
+// the key hash, for others that need to tell contents apart
+uint64_t cache_hash(const void *data, size_t len);
+
+#endif
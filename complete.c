@@ -0,0 +1,104 @@
+#include "complete.h"
+#include "pathindex.h"
+#include "jobcontrol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static int
+compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ *  Entries of the word's directory starting with its last component,
+ *  directories with a trailing /. Dot files only when asked for.
+ */
+
+static void
+complete_files(const char *word, dyarray *out)
+{
+    const char *slash = strrchr(word, '/');
+    const char *base = slash ? slash + 1 : word;
+    size_t base_len = strlen(base);
+    size_t dir_len = slash ? (size_t)(slash - word) + 1 : 0;
+    char *dir = slash ? strndup(word, slash == word ? 1 : dir_len - 1) : strdup(".");
+    DIR *dp = opendir(dir);
+    struct dirent *de;
+    struct stat st;
+    dystring ds;
+
+    init_dystring(&ds);
+
+    while(dp && (de = readdir(dp)))
+    {
+        if(strncmp(de->d_name, base, base_len))
+            continue;
+        if(de->d_name[0] == '.' && base[0] != '.')
+            continue;
+        if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+
+        append_dystring_n(&ds, word, dir_len);
+        merge_dystring(&ds, de->d_name);
+        if(fstatat(dirfd(dp), de->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode))
+            append_dystring(&ds, '/');
+        append_dyarray(out, ds.string);
+        free_dystring(&ds);
+    }
+
+    if(dp)
+        closedir(dp);
+    free(dir);
+
+    qsort(out->str, out->curr_size, sizeof(char *), compare_names);
+}
+
+/*
+ *  fg and bg take the pgid of a job
+ */
+
+static void
+complete_jobs(const char *word, dyarray *out)
+{
+    char id[32];
+
+    for(job *j = first_job; j; j = j->next)
+    {
+        snprintf(id, sizeof(id), "%d", (int)j->pgid);
+        if(!strncmp(id, word, strlen(word)))
+            append_dyarray(out, id);
+    }
+}
+
+#define WORD_BREAK "|;&()<>"
+#define COMMAND_START "|;&("
+
+void
+complete_line(const char *line, size_t pos, size_t *start, dyarray *out)
+{
+    size_t s = pos, p;
+
+    while(s > 0 && !isspace((unsigned char)line[s - 1]) && !strchr(WORD_BREAK, line[s - 1]))
+        s--;
+    *start = s;
+
+    // the word before, to know whether this one is a command name
+    for(p = s; p > 0 && isspace((unsigned char)line[p - 1]); p--){}
+
+    char *word = strndup(&line[s], pos - s);
+
+    if((p == 0 || strchr(COMMAND_START, line[p - 1])) && !strchr(word, '/'))
+        pathindex_complete(word, out);
+    else if(p >= 2 && (!strncmp(&line[p - 2], "fg", 2) || !strncmp(&line[p - 2], "bg", 2)) &&
+            (p == 2 || isspace((unsigned char)line[p - 3]) || strchr(COMMAND_START, line[p - 3])))
+        complete_jobs(word, out);
+    else
+        complete_files(word, out);
+
+    free(word);
+}
@@ -0,0 +1,14 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <stddef.h>
+#include "dynamicstring.h"
+
+/*
+ *  Tab completion for the word that ends at pos. *start is set to where
+ *  that word begins, every candidate in out replaces line[*start, pos).
+ */
+
+void complete_line(const char *line, size_t pos, size_t *start, dyarray *out);
+
+#endif
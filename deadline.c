@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+#include "deadline.h"
+#include "my_shell.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+typedef struct Deadline
+{
+    uint64_t at; // CLOCK_MONOTONIC ns
+    job *j;
+    char kill;   // the grace after a first signal is over: SIGKILL
+} Deadline;
+
+static Deadline *heap;
+static int heap_len, heap_cap;
+static int timer_fd = -1;
+static uint64_t default_timeout; // set -o jobtimeout, 0 for none
+
+/*
+ *  "1.5s", "300ms", "2m", "1h", "10" into ns, 0 if malformed
+ */
+
+static uint64_t
+parse_duration(const char *text)
+{
+    char *end;
+    double n;
+
+    if(text[0] < '0' || text[0] > '9')
+        return 0;
+    n = strtod(text, &end);
+
+    if(!strcmp(end, "ms"))
+        n /= 1e3;
+    else if(!strcmp(end, "m"))
+        n *= 60;
+    else if(!strcmp(end, "h"))
+        n *= 3600;
+    else if(*end && strcmp(end, "s"))
+        return 0;
+
+    return n * 1e9;
+}
+
+static int
+parse_signal(const char *text)
+{
+    static const struct { const char *name; int sig; } names[] = {
+        {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+        {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+        {NULL, 0}
+    };
+
+    if(text[0] >= '0' && text[0] <= '9')
+        return atoi(text) > 0 && atoi(text) < NSIG ? atoi(text) : -1;
+    if(!strncmp(text, "SIG", 3))
+        text += 3;
+    for(int i = 0; names[i].name; i++)
+        if(!strcmp(text, names[i].name))
+            return names[i].sig;
+
+    return -1;
+}
+
+int
+set_jobtimeout(char *value)
+{
+    uint64_t timeout;
+
+    if(value == NULL)
+    {
+        default_timeout = 0;
+        return 0;
+    }
+
+    // a bad duration keeps the timeout already in force
+    if((timeout = parse_duration(value)) == 0)
+    {
+        fprintf(stderr, "set: jobtimeout: %s: not a duration\n", value);
+        return 1 << 8;
+    }
+
+    default_timeout = timeout;
+    return 0;
+}
+
+/*
+ *  The shell's timer, and the one of a forked shell running a subshell or
+ *  a server request: it starts empty with its own timerfd, sharing the
+ *  parent's would rearm the parent's deadlines.
+ */
+
+int
+deadline_init()
+{
+    if(timer_fd >= 0)
+        close(timer_fd);
+    heap_len = 0;
+
+    timer_fd = shell_fd(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK));
+    if(timer_fd < 0)
+        perror("timerfd");
+
+    return timer_fd;
+}
+
+int
+deadline_fd()
+{
+    return timer_fd;
+}
+
+/*
+ *  j->timeout holds "DURATION" or "DURATION SIG" from the timeout keyword
+ */
+
+int
+deadline_check(job *j)
+{
+    char duration[64], sig[64] = "TERM";
+
+    j->timeout_ns = default_timeout;
+    j->timeout_sig = SIGTERM;
+    if(!j->timeout)
+        return 0;
+
+    if(sscanf(j->timeout, "%63s %63s", duration, sig) < 1 ||
+       !(j->timeout_ns = parse_duration(duration)) ||
+       (j->timeout_sig = parse_signal(sig)) < 0)
+    {
+        fprintf(stderr, "timeout: %s: expected DURATION [--signal SIG]\n", j->timeout);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+arm()
+{
+    struct itimerspec its = {{0, 0}, {0, 0}};
+
+    if(heap_len)
+    {
+        its.it_value.tv_sec = heap[0].at / 1000000000;
+        its.it_value.tv_nsec = heap[0].at % 1000000000;
+        if(its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+            its.it_value.tv_nsec = 1; // zero would disarm
+    }
+
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void
+place(int i, Deadline d)
+{
+    heap[i] = d;
+    d.j->deadline_slot = i;
+}
+
+static void
+sift_up(int i)
+{
+    Deadline d = heap[i];
+
+    while(i > 0 && heap[(i - 1) / 2].at > d.at)
+    {
+        place(i, heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    place(i, d);
+}
+
+static void
+sift_down(int i)
+{
+    Deadline d = heap[i];
+
+    for(;;)
+    {
+        int c = 2 * i + 1;
+        if(c >= heap_len)
+            break;
+        if(c + 1 < heap_len && heap[c + 1].at < heap[c].at)
+            c++;
+        if(heap[c].at >= d.at)
+            break;
+        place(i, heap[c]);
+        i = c;
+    }
+    place(i, d);
+}
+
+static void
+push(job *j, uint64_t at, char kill)
+{
+    if(heap_len == heap_cap)
+    {
+        heap_cap = heap_cap ? heap_cap * 2 : 16;
+        heap = realloc(heap, sizeof(Deadline) * heap_cap);
+    }
+
+    heap[heap_len] = (Deadline){at, j, kill};
+    sift_up(heap_len++);
+}
+
+static void
+remove_at(int i)
+{
+    heap[i].j->deadline_slot = -1;
+    if(--heap_len == i)
+        return;
+
+    heap[i] = heap[heap_len];
+    if(i > 0 && heap[(i - 1) / 2].at > heap[i].at)
+        sift_up(i);
+    else
+        sift_down(i);
+}
+
+void
+deadline_start(job *j)
+{
+    if(!j->timeout_ns || timer_fd < 0)
+        return;
+
+    int earliest = heap_len == 0 || stats_now() + j->timeout_ns < heap[0].at;
+
+    push(j, stats_now() + j->timeout_ns, 0);
+    if(earliest)
+        arm();
+}
+
+/*
+ *  Stop j now with sig, SIGKILL if it is still there after the grace
+ */
+
+void
+deadline_kill(job *j, int sig)
+{
+    deadline_cancel(j);
+    signal_job(j, sig);
+    if(sig == SIGKILL || timer_fd < 0)
+        return;
+
+    push(j, stats_now() + DEADLINE_GRACE, 1);
+    if(j->deadline_slot == 0)
+        arm();
+}
+
+void
+deadline_cancel(job *j)
+{
+    int i = j->deadline_slot;
+
+    if(i < 0 || i >= heap_len || heap[i].j != j)
+        return;
+
+    remove_at(i);
+    if(i == 0)
+        arm();
+}
+
+/*
+ *  The timer went off: signal every job whose deadline passed, and give
+ *  it DEADLINE_GRACE before SIGKILL
+ */
+
+void
+deadline_expire()
+{
+    uint64_t ticks, now = stats_now();
+
+    if(timer_fd < 0 || read(timer_fd, &ticks, sizeof(ticks)) < 0)
+    {
+        if(heap_len == 0 || heap[0].at > now)
+            return;
+    }
+
+    while(heap_len && heap[0].at <= now)
+    {
+        Deadline d = heap[0];
+
+        remove_at(0);
+        if(d.kill)
+            signal_job(d.j, SIGKILL);
+        else
+        {
+            d.j->timed_out = 1;
+            signal_job(d.j, d.j->timeout_sig);
+            if(d.j->timeout_sig != SIGKILL)
+                push(d.j, now + DEADLINE_GRACE, 1);
+        }
+    }
+
+    arm();
+}
@@ -0,0 +1,30 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include "jobcontrol.h"
+
+/*
+ *  timeout DURATION [--signal SIG] cmd | cmd2
+ *  set -o jobtimeout=DURATION    the same for every job without timeout
+ *
+ *  Durations are like 1.5s, 300ms, 2m, 1h (seconds without a unit). Once
+ *  a job's deadline passes it gets SIG (TERM by default), then SIGKILL
+ *  DEADLINE_GRACE later if it is still there, and its status is 124.
+ *
+ *  Deadlines sit in one min-heap behind one timerfd, armed for the
+ *  earliest. The fd is serviced wherever the shell waits: wait_for_job
+ *  and the line editor.
+ */
+
+#define DEADLINE_GRACE 5000000000ULL // ns between SIG and SIGKILL
+
+int set_jobtimeout(char *value);
+int deadline_init();
+int deadline_fd();
+int deadline_check(job *j);
+void deadline_start(job *j);
+void deadline_cancel(job *j);
+void deadline_kill(job *j, int sig);
+void deadline_expire();
+
+#endif
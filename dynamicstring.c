@@ -1,4 +1,5 @@
 #include "dynamicstring.h"
+#include "stats.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -6,49 +7,109 @@ dystring *
 new_dystring()
 {
     dystring *ds = malloc(sizeof(dystring));
+    STAT_INC(allocs);
+    STAT_ADD(alloc_bytes, sizeof(dystring));
     init_dystring(ds);
     return ds;
 }
 
 void init_dystring(dystring* ds){
     ds->curr_size = 0;
-    ds->max_size = 64;
-    ds->string = (char *) malloc(sizeof(char) * ds->max_size);
+    ds->max_size = DYSTRING_INLINE;
+    ds->string = ds->inline_buf;
     ds->string[0] = '\0';
 }
 
-void append_dystring(dystring* ds, char c){
-    if(ds->curr_size >= ds->max_size - 1){
-        ds->max_size *= 2;
-        ds->string = (char *) realloc(ds->string, sizeof(char) * ds->max_size);
+/*
+ *  Make room for size more characters and the terminating NUL
+ */
+
+void
+reserve_dystring(dystring *ds, size_t size)
+{
+    size_t needed = ds->curr_size + size + 1;
+
+    if(needed <= ds->max_size)
+        return;
+
+    size_t max_size = ds->max_size * 2;
+    while(max_size < needed)
+        max_size *= 2;
+
+    if(ds->string == ds->inline_buf)
+    {
+        ds->string = malloc(sizeof(char) * max_size);
+        memcpy(ds->string, ds->inline_buf, ds->curr_size + 1);
     }
+    else
+        ds->string = realloc(ds->string, sizeof(char) * max_size);
+
+    ds->max_size = max_size;
+    STAT_INC(allocs);
+    STAT_ADD(alloc_bytes, max_size);
+}
+
+void append_dystring(dystring* ds, char c){
+    if(ds->curr_size >= ds->max_size - 1)
+        reserve_dystring(ds, 1);
     ds->string[ds->curr_size++] = c;
     ds->string[ds->curr_size] = '\0';
 }
 
-void free_dystring(dystring *ds){
-    if(ds == NULL)
-        return;
-
-    free(ds->string);
-    ds->string = NULL;
-    ds->curr_size = 0;
-    ds->max_size = 0;
+void
+append_dystring_n(dystring *ds, const char *s, size_t n)
+{
+    reserve_dystring(ds, n);
+    memcpy(&ds->string[ds->curr_size], s, n);
+    ds->curr_size += n;
+    ds->string[ds->curr_size] = '\0';
 }
 
 void
-merge_dystring(dystring *ds, char *target)
+merge_dystring(dystring *ds, const char *target)
 {
-    size_t i;
+    append_dystring_n(ds, target, strlen(target));
+}
+
+/*
+ *  Move the string out of the builder. The caller owns (and frees) the
+ *  result, the builder is left empty and ready for reuse.
+ */
+
+char *
+steal_dystring(dystring *ds)
+{
+    char *res;
+
+    if(ds->string == ds->inline_buf)
+    {
+        res = malloc(ds->curr_size + 1);
+        memcpy(res, ds->inline_buf, ds->curr_size + 1);
+        STAT_INC(allocs);
+        STAT_ADD(alloc_bytes, ds->curr_size + 1);
+    }
+    else
+        res = ds->string;
 
-    for(i = 0; i < strlen(target); i++)
-        append_dystring(ds, target[i]);
+    init_dystring(ds);
+    return res;
+}
+
+void free_dystring(dystring *ds){
+    if(ds == NULL)
+        return;
+
+    if(ds->string != ds->inline_buf)
+        free(ds->string);
+    init_dystring(ds);
 }
 
 dyarray *
 new_dyarray()
 {
     dyarray *da = malloc(sizeof(dyarray));
+    STAT_INC(allocs);
+    STAT_ADD(alloc_bytes, sizeof(dyarray));
     init_dyarray(da);
     return da;
 }
@@ -60,6 +121,8 @@ init_dyarray(dyarray *da)
     da->max_size = 128;
     da->str = malloc(sizeof(char *) * da->max_size);
     da->str[0] = NULL;
+    STAT_INC(allocs);
+    STAT_ADD(alloc_bytes, sizeof(char *) * da->max_size);
 }
 
 void
@@ -69,9 +132,13 @@ append_dyarray(dyarray *da, char *s)
     {
         da->max_size *= 2;
         da->str = realloc(da->str, sizeof(char *) * da->max_size);
+        STAT_INC(allocs);
+        STAT_ADD(alloc_bytes, sizeof(char *) * da->max_size);
     }
 
     da->str[da->curr_size++] = strdup(s);
+    STAT_INC(allocs);
+    STAT_ADD(alloc_bytes, strlen(s) + 1);
     da->str[da->curr_size] = NULL;
 }
 
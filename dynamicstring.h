@@ -3,17 +3,29 @@
 
 #include <stddef.h>
 
+/*
+ *  String builder. Short strings stay in inline_buf, so a dystring must
+ *  not be copied by value. Take the result with steal_dystring, which
+ *  hands over a malloced string and leaves the builder empty.
+ */
+
+#define DYSTRING_INLINE 32
+
 typedef struct dystring{
-    char *string;
+    char *string; // inline_buf until the string outgrows it
     size_t max_size;
     size_t curr_size;
+    char inline_buf[DYSTRING_INLINE];
 }dystring;
 
 dystring *new_dystring();
 void init_dystring(dystring* ds);
+void reserve_dystring(dystring *ds, size_t size);
 void append_dystring(dystring* ds, char c);
+void append_dystring_n(dystring *ds, const char *s, size_t n);
+void merge_dystring(dystring *ds, const char *target);
+char *steal_dystring(dystring *ds);
 void free_dystring(dystring *ds);
-void merge_dystring(dystring *ds, char *target);
 
 typedef struct dyarray
 {
@@ -0,0 +1,371 @@
+#define _POSIX_C_SOURCE 200809L
+#include "expand.h"
+#include "dynamicstring.h"
+#include "my_shell.h"
+#include "rcfile.h"
+#include <ctype.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_IFS " \t\n"
+
+typedef struct
+{
+    dystring field;    // field being built
+    int started;       // field exists even if empty ("", '')
+    int split;         // split unquoted substitutions
+    const char *ifs;   // looked up on the first split
+    field_fn emit;
+    void *ctx;
+} Expander;
+
+static void expand_range(Expander *e, const char *str, const char *end, int quoted);
+
+static void
+emit_field(Expander *e)
+{
+    if(e->started)
+        e->emit(e->ctx, steal_dystring(&e->field));
+    e->started = 0;
+}
+
+static int
+ifs_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+/*
+ *  Append the result of a substitution. Outside quotes it is split as
+ *  POSIX says: a run of IFS whitespace ends the current field, and so
+ *  does each other IFS character with the whitespace around it, so
+ *  a::b gives a, an empty field and b. A trailing delimiter starts no
+ *  new field.
+ */
+
+static void
+append_value(Expander *e, const char *value, size_t len, int quoted)
+{
+    if(quoted || !e->split)
+    {
+        append_dystring_n(&e->field, value, len);
+        e->started = 1;
+        return;
+    }
+
+    if(!e->ifs)
+    {
+        e->ifs = find_environ("IFS", 3);
+        if(!e->ifs)
+            e->ifs = DEFAULT_IFS;
+    }
+
+    const char *end = value + len;
+
+    while(value < end)
+    {
+        size_t run = strcspn(value, e->ifs);
+        if(run > (size_t)(end - value))
+            run = end - value;
+
+        if(run)
+        {
+            append_dystring_n(&e->field, value, run);
+            e->started = 1;
+            value += run;
+        }
+
+        if(value == end)
+            break;
+
+        while(value < end && ifs_space(*value) && strchr(e->ifs, *value))
+            value++;
+        if(value < end && !ifs_space(*value) && strchr(e->ifs, *value))
+        {
+            e->started = 1; // ends a field even when it is empty
+            value++;
+            while(value < end && ifs_space(*value) && strchr(e->ifs, *value))
+                value++;
+        }
+        emit_field(e);
+    }
+}
+
+/*
+ *  Expansion of a nested word (default values, patterns) into one string
+ */
+
+static void
+collect_field(void *ctx, char *field)
+{
+    dystring *ds = ctx;
+    merge_dystring(ds, field);
+    free(field);
+}
+
+static void
+expand_nested(dystring *out, const char *str, const char *end)
+{
+    Expander e = {.split = 0, .emit = collect_field, .ctx = out};
+    init_dystring(&e.field);
+    expand_range(&e, str, end, 0);
+    emit_field(&e);
+    free_dystring(&e.field);
+}
+
+/*
+ *  Remove the shortest (or longest) prefix or suffix of value matching
+ *  pattern. Returns the kept part as an offset and length into value.
+ */
+
+static void
+trim(const char *value, size_t len, const char *pattern, int suffix, int longest,
+     size_t *off, size_t *keep)
+{
+    char *tmp = strndup(value, len);
+
+    *off = 0;
+    *keep = len;
+
+    for(size_t n = 0; n <= len; n++)
+    {
+        size_t cut = longest ? len - n : n; // length of the removed part
+
+        if(suffix)
+        {
+            if(!fnmatch(pattern, &tmp[len - cut], 0))
+            {
+                *keep = len - cut;
+                break;
+            }
+        }
+        else
+        {
+            char c = tmp[cut];
+            tmp[cut] = '\0';
+            int match = !fnmatch(pattern, tmp, 0);
+            tmp[cut] = c;
+
+            if(match)
+            {
+                *off = cut;
+                *keep = len - cut;
+                break;
+            }
+        }
+    }
+
+    free(tmp);
+}
+
+static int
+is_name_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+/*
+ *  ${...} starting at str (just past the brace). Returns a pointer past
+ *  the closing brace, or NULL if there is none.
+ */
+
+static const char *
+expand_braces(Expander *e, const char *str, const char *end, int quoted)
+{
+    const char *close = str;
+    int depth = 1;
+
+    for(; close < end; close++)
+    {
+        if(*close == '{') depth++;
+        if(*close == '}' && --depth == 0) break;
+    }
+
+    if(close >= end)
+        return NULL;
+
+    int length = (*str == '#' && close - str > 1);
+    if(length)
+        str++;
+
+    const char *name = str;
+    while(str < close && is_name_char(*str))
+        str++;
+
+    size_t name_len = str - name;
+    const char *value = name_len ? find_environ(name, name_len) : NULL; // borrow
+    size_t value_len = value ? strlen(value) : 0;
+
+    if(length)
+    {
+        char num[24];
+        snprintf(num, sizeof(num), "%zu", value_len);
+        append_value(e, num, strlen(num), quoted);
+        return close + 1;
+    }
+
+    if(str == close) // ${NAME}
+    {
+        if(value)
+            append_value(e, value, value_len, quoted);
+        return close + 1;
+    }
+
+    dystring word;
+    init_dystring(&word);
+
+    if(*str == '-' || (str[0] == ':' && str[1] == '-')) // ${NAME-default} ${NAME:-default}
+    {
+        int colon = (*str == ':');
+        str += colon + 1;
+
+        if(!value || (colon && !value_len))
+        {
+            expand_nested(&word, str, close);
+            append_value(e, word.string, word.curr_size, quoted);
+        }
+        else
+            append_value(e, value, value_len, quoted);
+    }
+    else if(*str == '%' || *str == '#') // ${NAME%pat} ${NAME%%pat} ${NAME#pat} ${NAME##pat}
+    {
+        int suffix = (*str == '%');
+        int longest = (str[1] == str[0]);
+        size_t off, keep;
+
+        str += longest + 1;
+        expand_nested(&word, str, close);
+        trim(value ? value : "", value_len, word.string, suffix, longest, &off, &keep);
+        if(keep)
+            append_value(e, value + off, keep, quoted);
+    }
+    else
+        fprintf(stderr, "%.*s: bad substitution\n", (int)(close - name), name);
+
+    free_dystring(&word);
+    return close + 1;
+}
+
+/*
+ *  $ at str. Returns a pointer past the expansion.
+ */
+
+static const char *
+expand_dollar(Expander *e, const char *str, const char *end, int quoted)
+{
+    char num[12];
+    const char *next = str + 1;
+
+    if(next < end && *next == '?') // exit status of last pipeline
+    {
+        rc_volatile();
+        snprintf(num, sizeof(num), "%d", exit_code(last_exit_status));
+        append_value(e, num, strlen(num), quoted);
+        return next + 1;
+    }
+
+    if(next < end && *next == '$') // pid of the shell
+    {
+        rc_volatile();
+        snprintf(num, sizeof(num), "%d", (int)getpid());
+        append_value(e, num, strlen(num), quoted);
+        return next + 1;
+    }
+
+    if(next < end && *next == '{')
+    {
+        const char *after = expand_braces(e, next + 1, end, quoted);
+        if(after)
+            return after;
+    }
+
+    const char *name = next;
+    while(next < end && is_name_char(*next))
+        next++;
+
+    if(next == name) // lone $ is literal
+    {
+        append_dystring(&e->field, '$');
+        e->started = 1;
+        return name;
+    }
+
+    const char *value = find_environ(name, next - name); // borrow
+    if(value)
+        append_value(e, value, strlen(value), quoted);
+
+    return next;
+}
+
+static void
+expand_range(Expander *e, const char *str, const char *end, int quoted)
+{
+    while(str < end)
+    {
+        if(*str == '\'' && !quoted)
+        {
+            const char *close = memchr(str + 1, '\'', end - str - 1);
+            if(!close)
+                close = end;
+            append_dystring_n(&e->field, str + 1, close - str - 1);
+            e->started = 1;
+            str = close < end ? close + 1 : end;
+            continue;
+        }
+
+        if(*str == '\"' && !quoted)
+        {
+            const char *close = memchr(str + 1, '\"', end - str - 1);
+            if(!close)
+                close = end;
+            e->started = 1;
+            expand_range(e, str + 1, close, 1);
+            str = close < end ? close + 1 : end;
+            continue;
+        }
+
+        if(*str == '$')
+        {
+            str = expand_dollar(e, str, end, quoted);
+            continue;
+        }
+
+        // literal run up to the next special character
+        const char *run = str + 1;
+        while(run < end && *run != '$' && (quoted || (*run != '\'' && *run != '\"')))
+            run++;
+
+        append_dystring_n(&e->field, str, run - str);
+        e->started = 1;
+        str = run;
+    }
+}
+
+void
+expand_word(const char *word, field_fn emit, void *ctx)
+{
+    Expander e = {.split = 1, .emit = emit, .ctx = ctx};
+
+    init_dystring(&e.field);
+    expand_range(&e, word, word + strlen(word), 0);
+    emit_field(&e);
+    free_dystring(&e.field);
+}
+
+/*
+ *  Expansion without field splitting, for assignments and redirection
+ *  targets
+ */
+
+char *
+expand_string(const char *word)
+{
+    dystring ds;
+
+    init_dystring(&ds);
+    expand_nested(&ds, word, word + strlen(word));
+    return steal_dystring(&ds);
+}
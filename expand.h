@@ -0,0 +1,15 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+/*
+ *  Word expansion: quote removal, $NAME, $?, $$, ${NAME}, ${NAME:-default},
+ *  ${#NAME} and ${NAME%pattern} style trimming, and IFS field splitting
+ *  of unquoted substitutions, all in one pass over the word.
+ */
+
+typedef void (*field_fn)(void *ctx, char *field); // takes ownership of field
+
+void expand_word(const char *word, field_fn emit, void *ctx);
+char *expand_string(const char *word);
+
+#endif
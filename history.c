@@ -0,0 +1,263 @@
+#define _GNU_SOURCE
+#include "history.h"
+#include "dynamicstring.h"
+#include "my_shell.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ *  Every shell appends to the same file with O_APPEND, one write per
+ *  entry, so concurrent shells interleave whole lines without locking.
+ *
+ *  At startup the file is mapped, not read, so a large history costs one
+ *  mmap before the first prompt. The line table is built the first time
+ *  an entry is looked up, the trigram index on the first search.
+ */
+
+#define TRIGRAM_BUCKETS (1 << 16)
+
+typedef struct Postings
+{
+    uint32_t *ids; // ascending ids of the entries containing the trigram
+    uint32_t len;
+    uint32_t cap;
+} Postings;
+
+static int hist_fd = -1;
+static const char *hist_map;     // the file as it was at startup
+static size_t hist_map_len;
+static size_t *hist_lines;       // offset of every mapped line
+static int hist_num_mapped = -1; // -1 until hist_lines is built
+static dyarray hist_session;     // entries added since startup
+static Postings *hist_index;     // NULL until the first search
+
+void
+history_open(const char *path)
+{
+    struct stat st;
+
+    hist_fd = shell_fd(open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600));
+    if(hist_fd < 0)
+    {
+        perror(path);
+        return;
+    }
+
+    if(fstat(hist_fd, &st) < 0 || st.st_size == 0)
+        return;
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, hist_fd, 0);
+    if(map == MAP_FAILED)
+    {
+        perror("history mmap");
+        return;
+    }
+
+    hist_map = map;
+    hist_map_len = st.st_size;
+}
+
+static void
+build_lines()
+{
+    const char *p = hist_map, *end = hist_map + hist_map_len;
+    int max_lines = 1024;
+    int n = 0;
+
+    hist_lines = malloc(sizeof(size_t) * max_lines);
+
+    while(p < end)
+    {
+        const char *nl = memchr(p, '\n', end - p);
+
+        if(n == max_lines)
+        {
+            max_lines *= 2;
+            hist_lines = realloc(hist_lines, sizeof(size_t) * max_lines);
+        }
+
+        hist_lines[n++] = p - hist_map;
+        p = nl ? nl + 1 : end;
+    }
+
+    hist_num_mapped = n;
+}
+
+int
+history_count()
+{
+    if(hist_num_mapped < 0)
+        build_lines();
+
+    return hist_num_mapped + hist_session.curr_size;
+}
+
+/*
+ *  Mapped entries are not NUL terminated, always use *len
+ */
+
+const char *
+history_line(int id, size_t *len)
+{
+    if(hist_num_mapped < 0)
+        build_lines();
+
+    if(id >= hist_num_mapped)
+    {
+        const char *s = hist_session.str[id - hist_num_mapped];
+        *len = strlen(s);
+        return s;
+    }
+
+    const char *s = hist_map + hist_lines[id];
+    size_t remain = hist_map_len - hist_lines[id];
+    const char *nl = memchr(s, '\n', remain);
+
+    *len = nl ? (size_t)(nl - s) : remain;
+    return s;
+}
+
+/*
+ *  Trigram index: bucket -> posting list of entry ids. Buckets are hashed,
+ *  so a posting list only says the entry may contain the trigram and
+ *  every candidate is checked with memmem.
+ */
+
+static inline unsigned
+trigram(const char *s)
+{
+    uint32_t t = (unsigned char)s[0] << 16 | (unsigned char)s[1] << 8 | (unsigned char)s[2];
+    return (t * 2654435761u) >> 16;
+}
+
+static void
+index_line(int id, const char *s, size_t len)
+{
+    for(size_t i = 0; i + 3 <= len; i++)
+    {
+        Postings *p = &hist_index[trigram(&s[i])];
+
+        if(p->len && p->ids[p->len - 1] == (uint32_t)id) // once per entry
+            continue;
+
+        if(p->len == p->cap)
+        {
+            p->cap = p->cap ? p->cap * 2 : 4;
+            p->ids = realloc(p->ids, sizeof(uint32_t) * p->cap);
+        }
+        p->ids[p->len++] = id;
+    }
+}
+
+static void
+build_index()
+{
+    int n = history_count();
+    size_t len;
+
+    hist_index = calloc(TRIGRAM_BUCKETS, sizeof(Postings));
+
+    for(int id = 0; id < n; id++)
+    {
+        const char *s = history_line(id, &len);
+        index_line(id, s, len);
+    }
+}
+
+static int
+entry_contains(int id, const char *query, size_t qlen)
+{
+    size_t len;
+    const char *s = history_line(id, &len);
+
+    return memmem(s, len, query, qlen) != NULL;
+}
+
+/*
+ *  Newest entry older than before that contains query, -1 if none.
+ *  Queries shorter than a trigram fall back to scanning backwards.
+ */
+
+int
+history_search(const char *query, int before)
+{
+    size_t qlen = strlen(query);
+    int n = history_count();
+
+    if(before > n)
+        before = n;
+
+    if(qlen < 3)
+    {
+        for(int id = before - 1; id >= 0; id--)
+            if(entry_contains(id, query, qlen))
+                return id;
+        return -1;
+    }
+
+    if(hist_index == NULL)
+        build_index();
+
+    // walk the shortest posting list among the query's trigrams
+    Postings *best = NULL;
+    for(size_t i = 0; i + 3 <= qlen; i++)
+    {
+        Postings *p = &hist_index[trigram(&query[i])];
+        if(best == NULL || p->len < best->len)
+            best = p;
+    }
+
+    uint32_t lo = 0, hi = best->len;
+    while(lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if(best->ids[mid] < (uint32_t)before)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    while(lo-- > 0)
+        if(entry_contains(best->ids[lo], query, qlen))
+            return best->ids[lo];
+
+    return -1;
+}
+
+void
+history_add(const char *line)
+{
+    size_t len = strlen(line);
+    dystring ds;
+
+    if(len == 0)
+        return;
+
+    if(hist_session.str == NULL)
+        init_dyarray(&hist_session);
+
+    // skip repeats of the command just run
+    if(hist_session.curr_size && !strcmp(hist_session.str[hist_session.curr_size - 1], line))
+        return;
+
+    if(hist_fd >= 0)
+    {
+        init_dystring(&ds);
+        append_dystring_n(&ds, line, len);
+        append_dystring(&ds, '\n');
+        if(write(hist_fd, ds.string, ds.curr_size) < 0) // one write keeps the line whole
+            perror("history");
+        free_dystring(&ds);
+    }
+
+    append_dyarray(&hist_session, (char *)line);
+
+    if(hist_index)
+        index_line(history_count() - 1, line, len);
+}
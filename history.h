@@ -0,0 +1,18 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+/*
+ *  Command history shared by every shell through one append-only file.
+ *  Entries are numbered oldest first: the lines of the file as it was
+ *  mapped at startup, then the lines of this session.
+ */
+
+void history_open(const char *path);
+void history_add(const char *line);
+int history_count();
+const char *history_line(int id, size_t *len);
+int history_search(const char *query, int before);
+
+#endif
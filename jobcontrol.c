@@ -1,6 +1,14 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include "jobcontrol.h"
 #include "my_shell.h"
+#include "trace.h"
+#include "stats.h"
+#include "prompt.h"
+#include "pipestat.h"
+#include "priority.h"
+#include "rlimits.h"
+#include "deadline.h"
+#include "outbuf.h"
 #include <string.h>
 #include <sys/types.h>
 #include <signal.h>
@@ -8,9 +16,14 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <time.h>
 
 job *first_job = NULL;
+double last_job_wall = 0;
+int wait_wake_fd = -1;
 
 job *
 find_job(pid_t pgid)
@@ -24,7 +37,7 @@ find_job(pid_t pgid)
     return NULL;
 }
 
-static int
+int
 job_is_stopped(job *j)
 {
     process *p;
@@ -32,11 +45,14 @@ job_is_stopped(job *j)
     for(p = j->first_process; p; p = p->next)
         if(!p->completed && !p->stopped)
             return 0;
+    for(p = j->relays; p; p = p->next)
+        if(!p->completed && !p->stopped)
+            return 0;
     
     return 1;
 }
 
-static int
+int
 job_is_completed(job *j)
 {
     process *p;
@@ -44,6 +60,9 @@ job_is_completed(job *j)
     for(p = j->first_process; p; p = p->next)
         if(!p->completed)
             return 0;
+    for(p = j->relays; p; p = p->next)
+        if(!p->completed)
+            return 0;
     
     return 1;
 }
@@ -61,6 +80,8 @@ put_job_in_foreground(job *j, int cont)
 {
     tcsetpgrp(shell_terminal, j->pgid);
 
+    priority_foreground(j);
+
     if(cont)
     {
         tcsetattr(shell_terminal, TCSADRAIN, &j->tmodes);
@@ -79,17 +100,22 @@ put_job_in_foreground(job *j, int cont)
 void
 put_job_in_background(job *j, int cont)
 {
+    priority_background(j);
+
     if(cont)
         if(kill(-j->pgid, SIGCONT) < 0)
             perror("kill (SIGCONT)");
 }
 
 static int
-mark_process_status(pid_t pid,  int status)
+mark_process_status(pid_t pid,  int status, struct rusage *ru)
 {
     job *j;
     process *p;
 
+    if(pid > 0 && prompt_helper(pid)) // not a job
+        return 0;
+
     if(pid > 0)
     {
         for(j = first_job; j; j = j->next)
@@ -105,11 +131,33 @@ mark_process_status(pid_t pid,  int status)
                     else
                     {
                         p->completed = 1;
-                        if(WIFSIGNALED(status))
+                        p->rusage = *ru;
+                        STAT_INC(reaped);
+                        clock_gettime(CLOCK_MONOTONIC, &p->end);
+                        const char *hit = limits_hit(j, p);
+                        if(WIFSIGNALED(status) && hit)
+                            fprintf(stderr, "%d: Terminated by signal %d (limit %s).\n", (int) pid, WTERMSIG(p->status), hit);
+                        else if(WIFSIGNALED(status))
                             fprintf(stderr, "%d: Terminated by signal %d.\n", (int) pid, WTERMSIG(p->status));
                     }
                     return 0;
                 }
+
+        // relays only finish or stop, the job's status is its last stage's
+        for(j = first_job; j; j = j->next)
+            for(p = j->relays; p; p = p->next)
+                if(p->pid == pid)
+                {
+                    if(WIFSTOPPED(status))
+                        p->stopped = 1;
+                    else
+                    {
+                        p->completed = 1;
+                        STAT_INC(reaped);
+                    }
+                    return 0;
+                }
+
         fprintf(stderr, "No child process %d.\n", (int) pid);
         return -1;
     }
@@ -117,7 +165,7 @@ mark_process_status(pid_t pid,  int status)
         return -1;
     else
     {
-        perror("waitpid");
+        perror("wait4");
         return -1;
     }
 }
@@ -127,34 +175,112 @@ update_status()
 {
     int status;
     pid_t pid;
+    struct rusage ru;
 
     do
     {
-        pid = waitpid(-1, &status, WUNTRACED | WNOHANG);
-    } while (!mark_process_status(pid, status));
-    
+        pid = wait4(-1, &status, WUNTRACED | WNOHANG, &ru);
+    } while (!mark_process_status(pid, status, &ru));
+
 }
 
 void
 wait_for_job(job *j)
 {
-    do
-    {
-        sigsuspend(&prev_chld);
-    } while (!job_is_stopped(j) &&
-             !job_is_completed(j));
+    uint64_t start = TRACE_START();
+    struct pollfd fds[2] = {{deadline_fd(), POLLIN, 0}, {wait_wake_fd, POLLIN, 0}};
+
+    outbuf_flush_all();
+
+    // sigsuspend, but also woken by the deadline timer
+    while(!job_is_stopped(j) && !job_is_completed(j))
+        if(ppoll(fds, 2, NULL, &prev_chld) > 0)
+        {
+            if(fds[0].revents & POLLIN)
+                deadline_expire();
+            if(fds[1].revents & POLLIN)
+                break;
+        }
+
+    TRACE_END("wait", start, "pgid", (long)j->pgid);
 }
 
 void
 format_job_info(job *j, const char *status)
 {
-    fprintf(stderr, "%ld (%s): %s\n", (long)j->pgid, status, j->command);
+    outbuf_printf(STDERR_FILENO, "%ld (%s): %s\n", (long)j->pgid, status, j->command);
+}
+
+static double
+elapsed(struct timespec *from, struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static double
+tv_seconds(struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/*
+ *  Reap time of the last process of a completed job
+ */
+
+static struct timespec
+job_end(job *j)
+{
+    struct timespec last = j->start;
+
+    for(process *p = j->first_process; p; p = p->next)
+        if(elapsed(&last, &p->end) > 0)
+            last = p->end;
+
+    return last;
+}
+
+/*
+ *  Report of the time keyword. One line per pipeline stage with wall,
+ *  user and system time, max RSS and voluntary/involuntary context
+ *  switches, then the totals of the whole job.
+ */
+
+void
+format_job_times(job *j)
+{
+    process *p;
+    struct timespec last = job_end(j);
+    double user = 0, sys = 0;
+
+    outbuf_printf(STDERR_FILENO, "%8s %9s %9s %9s %10s %7s %7s  %s\n",
+                  "pid", "real", "user", "sys", "maxrss", "vcsw", "ivcsw", "command");
+
+    for(p = j->first_process; p; p = p->next)
+    {
+        struct rusage *ru = &p->rusage;
+
+        outbuf_printf(STDERR_FILENO, "%8ld %8.3fs %8.3fs %8.3fs %8ldKB %7ld %7ld  %s\n",
+                      (long)p->pid, elapsed(&p->start, &p->end),
+                      tv_seconds(&ru->ru_utime), tv_seconds(&ru->ru_stime),
+                      ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw, p->argv[0]);
+
+        user += tv_seconds(&ru->ru_utime);
+        sys += tv_seconds(&ru->ru_stime);
+    }
+
+    outbuf_printf(STDERR_FILENO, "real %.3fs  user %.3fs  sys %.3fs\n",
+                  elapsed(&j->start, &last), user, sys);
 }
 
 void
 freejob(job *j)
 {
     free(j->command);
+    free(j->cpus);
+    free(j->limits);
+    free(j->limits_applied);
+    free(j->timeout);
+    deadline_cancel(j);
     process *p = j->first_process;
     process *next;
 
@@ -176,15 +302,26 @@ freejob(job *j)
         for(int i=0; p->argv[i] != 0; i++)
             free(p->argv[i]);
         free(p->argv);
+        free(p->path);
 
-        for(int i=0; p->envp[i]; i++)
-            free(p->envp[i]);
-        free(p->envp);
+        if(p->envp)
+        {
+            for(int i=0; p->envp[i]; i++)
+                free(p->envp[i]);
+            free(p->envp);
+        }
 
         free(p);
         p = next;
     }
 
+    for(p = j->relays; p; p = next)
+    {
+        next = p->next;
+        free(p);
+    }
+    pipestat_free(j);
+
     free(j);
 }
 
@@ -192,6 +329,7 @@ void
 do_job_notification()
 {
     job *j, *jlast, *jnext;
+    uint64_t start = TRACE_START();
 
     sigprocmask(SIG_BLOCK, &mask_chld, &prev_chld);
     update_status();
@@ -203,7 +341,26 @@ do_job_notification()
 
         if(job_is_completed(j))
         {
-            format_job_info(j, "completed");
+            const char *hit = NULL;
+            char status[96];
+
+            for(process *p = j->first_process; p && !hit; p = p->next)
+                hit = limits_hit(j, p);
+            if(hit)
+            {
+                snprintf(status, sizeof(status), "completed, limit %s", hit);
+                format_job_info(j, status);
+            }
+            else if(j->timed_out)
+                format_job_info(j, "completed, timed out");
+            else
+                format_job_info(j, "completed");
+            if(j->timed)
+                format_job_times(j);
+            pipestat_report(j);
+            struct timespec end = job_end(j);
+            last_job_wall = elapsed(&j->start, &end);
+            stats_record(&shell_stats->job_wall, last_job_wall * 1e9);
             if(jlast)
                 jlast->next = jnext;
             else
@@ -220,7 +377,9 @@ do_job_notification()
             jlast = j;
     }
     
+    outbuf_flush(STDERR_FILENO); // one write for all of them, before SIGCHLD can print again
     sigprocmask(SIG_SETMASK, &prev_chld, NULL);
+    TRACE_END("notify", start, "jobs", 0);
 }
 
 static void
@@ -230,6 +389,8 @@ mark_job_as_running(job *j)
 
     for(p = j->first_process; p; p = p->next)
         p->stopped = 0;
+    for(p = j->relays; p; p = p->next)
+        p->stopped = 0;
     j->notified = 0;
 }
 
@@ -264,10 +425,109 @@ cleanup_all()
     sigprocmask(SIG_SETMASK, &prev_clean, NULL);
 }
 
+/*
+ *  jobs [-v]: every job still known to the shell, -v adds the live
+ *  pipestat counters of the jobs that have them
+ */
+
+void
+list_jobs(int verbose)
+{
+    sigprocmask(SIG_BLOCK, &mask_chld, &prev_chld);
+    update_status();
+
+    for(job *j = first_job; j; j = j->next)
+    {
+        format_job_info(j, job_is_completed(j) ? "completed" :
+                           job_is_stopped(j) ? "stopped" : "running");
+        if(verbose)
+            pipestat_report(j);
+    }
+
+    outbuf_flush(STDERR_FILENO);
+    sigprocmask(SIG_SETMASK, &prev_chld, NULL);
+}
+
+/*
+ *  Relays are forks of the shell that move a job's data between fds
+ *  (pipestat links, multios fan-outs). They join the job's process group
+ *  so ^C and ^Z reach them, and the job completes once they have exited.
+ *  Returns like fork. A relay must leave with _exit: exit() would seek
+ *  the shell's stdin back under a script.
+ */
+
+pid_t
+fork_relay(job *j)
+{
+    STAT_INC(forks);
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        if(shell_is_interactive)
+            setpgid(0, j->pgid);
+        sigprocmask(SIG_SETMASK, &prev_chld, NULL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        signal(SIGPIPE, SIG_IGN); // a reader gone is EPIPE, handled in place
+        priority_apply();
+        return 0;
+    }
+    if(pid < 0)
+    {
+        perror("fork (relay)");
+        return -1;
+    }
+
+    if(shell_is_interactive)
+    {
+        if(!j->pgid)
+            j->pgid = pid;
+        setpgid(pid, j->pgid);
+    }
+
+    process *r = new_process();
+    r->pid = pid;
+    r->next = j->relays;
+    j->relays = r;
+
+    return pid;
+}
+
+/*
+ *  sig to every process of j. Without job control the processes share
+ *  the shell's group, so they are signalled one by one. SIGCONT after,
+ *  or a stopped job would never act on it.
+ */
+
+void
+signal_job(job *j, int sig)
+{
+    if(j->pgid > 0)
+    {
+        kill(-j->pgid, sig);
+        kill(-j->pgid, SIGCONT);
+        return;
+    }
+
+    for(int relays = 0; relays < 2; relays++)
+        for(process *p = relays ? j->relays : j->first_process; p; p = p->next)
+            if(p->pid > 0 && !p->completed)
+            {
+                kill(p->pid, sig);
+                kill(p->pid, SIGCONT);
+            }
+}
+
 job *
 new_job()
 {
     job *j = malloc(sizeof(job));
+    STAT_INC(allocs);
+    STAT_ADD(alloc_bytes, sizeof(job));
     j->next = NULL;
     j->command = NULL;
     j->first_process = NULL;
@@ -278,6 +538,19 @@ new_job()
     j->stdout = STDOUT_FILENO;
     j->stderr = STDERR_FILENO;
     j->status = -1;
+    j->timed = 0;
+    j->cpus = NULL;
+    j->node = -1;
+    j->limits = NULL;
+    j->limits_applied = NULL;
+    j->lowered = 0;
+    j->timeout = NULL;
+    j->timeout_ns = 0;
+    j->timeout_sig = SIGTERM;
+    j->deadline_slot = -1;
+    j->timed_out = 0;
+    j->relays = NULL;
+    j->pipestat = NULL;
     return j;
 }
 
@@ -285,14 +558,18 @@ process *
 new_process()
 {
     process *p = malloc(sizeof(process));
-    p->argv = malloc(sizeof(char *) * 32);
+    STAT_INC(allocs);
+    STAT_ADD(alloc_bytes, sizeof(process));
+    p->argv = NULL; // set by the parser
     p->next = NULL;
     p->pid = -1;
     p->completed = 0;
     p->stopped = 0;
     p->status = -1;
     p->redirs = NULL;
-    p->envp = NULL;
+    p->envp = NULL; // NULL unless there are NAME=value words
+    p->path = NULL;
+    memset(&p->rusage, 0, sizeof(p->rusage));
     return p;
 }
 
@@ -300,6 +577,8 @@ redirection *
 new_redirection()
 {
     redirection *r = malloc(sizeof(redirection));
+    STAT_INC(allocs);
+    STAT_ADD(alloc_bytes, sizeof(redirection));
     r->fd_source = -1;
     r->next = NULL;
     r->type = REDIR_NONE;
@@ -1,8 +1,11 @@
 #ifndef JOBCONTROL_H
 #define JOBCONTROL_H
 
+#include <stdint.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <termios.h>
+#include <time.h>
 
 typedef enum
 {
@@ -26,11 +29,14 @@ typedef struct process
     struct process *next;
     char **argv;
     char **envp;
+    char *path; // argv[0] resolved through the PATH index before fork, or NULL
     pid_t pid;
     char completed;
     char stopped;
     int status;
     redirection *redirs;
+    struct timespec start, end; // fork and reap time
+    struct rusage rusage;       // filled in by wait4 once completed
 } process;
 
 typedef struct job
@@ -43,20 +49,42 @@ typedef struct job
     struct termios tmodes;
     int stdin, stdout, stderr;
     int status;
+    char timed;              // prefixed with the time keyword
+    char *cpus;              // @cpus=LIST, or NULL
+    int node;                // @node=N, or -1
+    char *limits;            // name=value words after limit, or NULL
+    char *limits_applied;    // ulimit's words then those, as set at launch
+    char lowered;            // running with the set -o bgnice priority
+    char *timeout;           // "DURATION [SIG]" after timeout, or NULL
+    uint64_t timeout_ns;     // from timeout or set -o jobtimeout, 0 for none
+    int timeout_sig;
+    int deadline_slot;       // index in the deadline heap, or -1
+    char timed_out;          // the deadline passed and the job was signalled
+    struct timespec start;   // launch time
+    process *relays;         // set -o pipestat relays, one per link
+    struct pipestat *pipestat;
 } job;
 
 extern job *first_job;
+extern double last_job_wall; // seconds, for the prompt
+extern int wait_wake_fd;     // wait_for_job also returns once it is readable, -1 for none
 
 job *find_job(pid_t pgid);
+int job_is_stopped(job *j);
+int job_is_completed(job *j);
 void wait_for_job(job *j);
 void put_job_in_foreground(job *j, int cont);
 void put_job_in_background(job *j, int cont);
 void update_status();
 void do_job_notification();
 void format_job_info(job *j, const char *status);
+void format_job_times(job *j);
 void freejob(job *j);
 void continue_job(job *j, int foreground);
 void cleanup_all();
+void list_jobs(int verbose);
+pid_t fork_relay(job *j);
+void signal_job(job *j, int sig);
 
 job *new_job();
 process *new_process();
@@ -0,0 +1,510 @@
+#include "lineedit.h"
+#include "history.h"
+#include "complete.h"
+#include "dynamicstring.h"
+#include "tokenizer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <termios.h>
+#include <unistd.h>
+#include <poll.h>
+
+/*
+ *  A minimal editor: one line, no wrapping, bytes drawn as they are.
+ *  Every change redraws the whole line, which is plenty for a prompt.
+ */
+
+#define CTRL(c) ((c) & 0x1f)
+
+enum
+{
+    KEY_ESC = 27,
+    KEY_BACKSPACE = 127,
+    KEY_UP = 1000,
+    KEY_DOWN,
+    KEY_RIGHT,
+    KEY_LEFT,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE
+};
+
+typedef struct LineState
+{
+    const char *prompt;
+    dystring buf;
+    size_t pos;     // cursor, index into buf
+    int hist_id;    // entry shown by up/down, -1 while editing a new line
+    dystring saved; // the new line while browsing history
+} LineState;
+
+static int notify_fd = -1;
+static const char *(*reprompt)();
+static int timer_fd = -1;
+static void (*on_timer)();
+
+void
+lineedit_set_notify(int fd, const char *(*fn)())
+{
+    notify_fd = fd;
+    reprompt = fn;
+}
+
+void
+lineedit_set_timer(int fd, void (*fn)())
+{
+    timer_fd = fd;
+    on_timer = fn;
+}
+
+static int
+read_key()
+{
+    unsigned char c, seq[3];
+    ssize_t n;
+
+    while((n = read(STDIN_FILENO, &c, 1)) < 0 && errno == EINTR){}
+    if(n <= 0)
+        return -1;
+
+    if(c != KEY_ESC)
+        return c;
+
+    if(read(STDIN_FILENO, &seq[0], 1) <= 0 || read(STDIN_FILENO, &seq[1], 1) <= 0)
+        return KEY_ESC;
+
+    if(seq[0] == '[' && seq[1] >= '0' && seq[1] <= '9')
+    {
+        if(read(STDIN_FILENO, &seq[2], 1) <= 0 || seq[2] != '~')
+            return KEY_ESC;
+
+        switch(seq[1])
+        {
+            case '1': case '7': return KEY_HOME;
+            case '4': case '8': return KEY_END;
+            case '3': return KEY_DELETE;
+        }
+        return KEY_ESC;
+    }
+
+    if(seq[0] == '[' || seq[0] == 'O')
+    {
+        switch(seq[1])
+        {
+            case 'A': return KEY_UP;
+            case 'B': return KEY_DOWN;
+            case 'C': return KEY_RIGHT;
+            case 'D': return KEY_LEFT;
+            case 'H': return KEY_HOME;
+            case 'F': return KEY_END;
+        }
+    }
+
+    return KEY_ESC;
+}
+
+static void
+write_all(const char *s, size_t len)
+{
+    ssize_t n;
+
+    while(len > 0)
+    {
+        n = write(STDOUT_FILENO, s, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return;
+        s += n;
+        len -= n;
+    }
+}
+
+static void
+refresh(LineState *ls)
+{
+    dystring out;
+    char move[32];
+    size_t col = strlen(ls->prompt) + ls->pos;
+
+    init_dystring(&out);
+    merge_dystring(&out, "\r");
+    merge_dystring(&out, ls->prompt);
+    append_dystring_n(&out, ls->buf.string, ls->buf.curr_size);
+    merge_dystring(&out, "\x1b[K\r");
+    if(col)
+    {
+        snprintf(move, sizeof(move), "\x1b[%zuC", col);
+        merge_dystring(&out, move);
+    }
+
+    write_all(out.string, out.curr_size);
+    free_dystring(&out);
+}
+
+static void
+set_line(LineState *ls, const char *s, size_t len)
+{
+    free_dystring(&ls->buf);
+    append_dystring_n(&ls->buf, s, len);
+    ls->pos = len;
+}
+
+static void
+insert_char(LineState *ls, char c)
+{
+    dystring *b = &ls->buf;
+
+    reserve_dystring(b, 1);
+    memmove(&b->string[ls->pos + 1], &b->string[ls->pos], b->curr_size - ls->pos + 1);
+    b->string[ls->pos++] = c;
+    b->curr_size++;
+}
+
+static void
+delete_range(LineState *ls, size_t from, size_t to)
+{
+    dystring *b = &ls->buf;
+
+    memmove(&b->string[from], &b->string[to], b->curr_size - to + 1);
+    b->curr_size -= to - from;
+    ls->pos = from;
+}
+
+static void
+history_move(LineState *ls, int dir)
+{
+    const char *s;
+    size_t len;
+
+    if(ls->hist_id < 0)
+    {
+        if(dir > 0)
+            return;
+        ls->hist_id = history_count();
+        free_dystring(&ls->saved);
+        append_dystring_n(&ls->saved, ls->buf.string, ls->buf.curr_size);
+    }
+
+    if(ls->hist_id + dir < 0)
+        return;
+
+    ls->hist_id += dir;
+    if(ls->hist_id >= history_count())
+    {
+        ls->hist_id = -1;
+        set_line(ls, ls->saved.string, ls->saved.curr_size);
+        return;
+    }
+
+    s = history_line(ls->hist_id, &len);
+    set_line(ls, s, len);
+}
+
+/*
+ *  Wait for a key. Meanwhile, whenever notify_fd turns readable the
+ *  prompt has changed: take the new one and draw the line again. A
+ *  readable timer_fd goes to on_timer.
+ */
+
+static int
+next_key(LineState *ls)
+{
+    struct pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0}, {notify_fd, POLLIN, 0}, {timer_fd, POLLIN, 0}};
+
+    while(notify_fd >= 0 || timer_fd >= 0)
+    {
+        if(poll(fds, 3, -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        if(fds[0].revents)
+            break;
+
+        if(fds[1].revents & POLLIN)
+        {
+            ls->prompt = reprompt();
+            refresh(ls);
+        }
+
+        if(fds[2].revents & POLLIN)
+            on_timer();
+    }
+
+    return read_key();
+}
+
+/*
+ *  Tab: extend the word to the longest prefix all candidates share, with
+ *  a space after a unique match. When that adds nothing, list them.
+ */
+
+#define MAX_LISTED 100
+
+static void
+complete(LineState *ls)
+{
+    dyarray cands;
+    size_t start, typed, common;
+    int n;
+
+    init_dyarray(&cands);
+    complete_line(ls->buf.string, ls->pos, &start, &cands);
+    n = cands.curr_size;
+    typed = ls->pos - start;
+
+    if(n == 0)
+    {
+        free_dyarray(&cands);
+        return;
+    }
+
+    common = strlen(cands.str[0]);
+    for(int i = 1; i < n; i++)
+    {
+        size_t k = 0;
+        while(k < common && cands.str[i][k] == cands.str[0][k])
+            k++;
+        common = k;
+    }
+
+    if(common > typed || n == 1)
+    {
+        // the candidate may not start with what was typed (a/./b), replace it whole
+        delete_range(ls, start, ls->pos);
+        for(size_t k = 0; k < common; k++)
+            insert_char(ls, cands.str[0][k]);
+        if(n == 1 && cands.str[0][common - 1] != '/')
+            insert_char(ls, ' ');
+    }
+    else
+    {
+        dystring out;
+        init_dystring(&out);
+        merge_dystring(&out, "\r\n");
+        for(int i = 0; i < n && i < MAX_LISTED; i++)
+        {
+            merge_dystring(&out, cands.str[i]);
+            merge_dystring(&out, "  ");
+        }
+        if(n > MAX_LISTED)
+            merge_dystring(&out, "...");
+        merge_dystring(&out, "\r\n");
+        write_all(out.string, out.curr_size);
+        free_dystring(&out);
+    }
+
+    free_dyarray(&cands);
+}
+
+/*
+ *  Ctrl-R: incremental search backwards through history. Returns 1 when
+ *  Enter accepted the match and the line should run, 0 when the match
+ *  (or the original line, on Ctrl-G / Ctrl-C) was left for editing.
+ */
+
+static int
+reverse_search(LineState *ls)
+{
+    dystring query, out;
+    int match = -1;
+    const char *s = "";
+    size_t len = 0;
+    int key;
+
+    init_dystring(&query);
+
+    for(;;)
+    {
+        init_dystring(&out);
+        merge_dystring(&out, "\r(reverse-i-search)`");
+        merge_dystring(&out, query.string);
+        merge_dystring(&out, match < 0 && query.curr_size ? "' [no match]: " : "': ");
+        append_dystring_n(&out, s, len);
+        merge_dystring(&out, "\x1b[K");
+        write_all(out.string, out.curr_size);
+        free_dystring(&out);
+
+        key = read_key();
+
+        if(key == CTRL('R'))
+        {
+            if(match > 0 && query.curr_size)
+            {
+                int older = history_search(query.string, match);
+                if(older >= 0)
+                    match = older;
+            }
+        }
+        else if(key == KEY_BACKSPACE || key == CTRL('H'))
+        {
+            if(query.curr_size)
+                query.string[--query.curr_size] = '\0';
+            match = query.curr_size ? history_search(query.string, history_count()) : -1;
+        }
+        else if(key >= 32 && key < 256)
+        {
+            append_dystring(&query, key);
+            // the current match stays if it still contains the longer query
+            match = history_search(query.string, match < 0 ? history_count() : match + 1);
+        }
+        else
+            break;
+
+        if(match >= 0)
+            s = history_line(match, &len);
+        else
+        {
+            s = "";
+            len = 0;
+        }
+    }
+
+    free_dystring(&query);
+
+    if(key == CTRL('G') || key == CTRL('C') || key < 0)
+    {
+        refresh(ls);
+        return 0;
+    }
+
+    if(match >= 0)
+        set_line(ls, s, len);
+    refresh(ls);
+
+    return key == '\r' || key == '\n';
+}
+
+char *
+lineedit(const char *prompt)
+{
+    struct termios orig, raw;
+    LineState ls;
+    int done = 0;
+    int key;
+
+    fflush(stdout);
+
+    if(tcgetattr(STDIN_FILENO, &orig) < 0)
+    {
+        printf("%s", prompt);
+        fflush(stdout);
+        return readline();
+    }
+
+    raw = orig;
+    raw.c_iflag &= ~(ICRNL | IXON);
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+    ls.prompt = prompt;
+    ls.pos = 0;
+    ls.hist_id = -1;
+    init_dystring(&ls.buf);
+    init_dystring(&ls.saved);
+    refresh(&ls);
+
+    while(!done)
+    {
+        key = next_key(&ls);
+
+        switch(key)
+        {
+            case -1:
+                done = -1;
+                break;
+            case CTRL('D'):
+                if(ls.buf.curr_size == 0)
+                    done = -1;
+                else if(ls.pos < ls.buf.curr_size)
+                    delete_range(&ls, ls.pos, ls.pos + 1);
+                break;
+            case '\r':
+            case '\n':
+                done = 1;
+                break;
+            case CTRL('C'):
+                write_all("^C", 2);
+                free_dystring(&ls.buf);
+                done = 1;
+                break;
+            case KEY_BACKSPACE:
+            case CTRL('H'):
+                if(ls.pos > 0)
+                    delete_range(&ls, ls.pos - 1, ls.pos);
+                break;
+            case KEY_DELETE:
+                if(ls.pos < ls.buf.curr_size)
+                    delete_range(&ls, ls.pos, ls.pos + 1);
+                break;
+            case KEY_LEFT:
+            case CTRL('B'):
+                if(ls.pos > 0)
+                    ls.pos--;
+                break;
+            case KEY_RIGHT:
+            case CTRL('F'):
+                if(ls.pos < ls.buf.curr_size)
+                    ls.pos++;
+                break;
+            case KEY_HOME:
+            case CTRL('A'):
+                ls.pos = 0;
+                break;
+            case KEY_END:
+            case CTRL('E'):
+                ls.pos = ls.buf.curr_size;
+                break;
+            case CTRL('U'):
+                delete_range(&ls, 0, ls.pos);
+                break;
+            case CTRL('K'):
+                delete_range(&ls, ls.pos, ls.buf.curr_size);
+                break;
+            case CTRL('L'):
+                write_all("\x1b[H\x1b[2J", 7);
+                break;
+            case KEY_UP:
+            case CTRL('P'):
+                history_move(&ls, -1);
+                break;
+            case KEY_DOWN:
+            case CTRL('N'):
+                history_move(&ls, 1);
+                break;
+            case '\t':
+                complete(&ls);
+                break;
+            case CTRL('R'):
+                if(reverse_search(&ls))
+                    done = 1;
+                break;
+            default:
+                if(key >= 32 && key < 256 && key != KEY_BACKSPACE)
+                    insert_char(&ls, key);
+                break;
+        }
+
+        if(!done)
+            refresh(&ls);
+    }
+
+    write_all("\r\n", 2);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &orig);
+    free_dystring(&ls.saved);
+
+    if(done < 0)
+    {
+        free_dystring(&ls.buf);
+        return NULL;
+    }
+
+    return steal_dystring(&ls.buf);
+}
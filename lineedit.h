@@ -0,0 +1,25 @@
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+/*
+ *  Read one line from the terminal in raw mode with editing keys, history
+ *  (up/down), reverse search (Ctrl-R) and completion (Tab). Returns a
+ *  malloced line, or NULL on Ctrl-D at an empty line.
+ */
+
+char *lineedit(const char *prompt);
+
+/*
+ *  While waiting for input, redraw with fn()'s prompt each time fd has
+ *  something to read. fn must drain fd.
+ */
+
+void lineedit_set_notify(int fd, const char *(*fn)());
+
+/*
+ *  While waiting for input, call fn() each time fd has something to read
+ */
+
+void lineedit_set_timer(int fd, void (*fn)());
+
+#endif
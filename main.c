@@ -0,0 +1,20 @@
+#include "my_shell.h"
+#include "server.h"
+#include <stdio.h>
+#include <string.h>
+
+int
+main(int argc, char **argv)
+{
+    if(argc == 3 && !strcmp(argv[1], "--server"))
+        return server_main(argv[2]);
+
+    if(argc > 1)
+    {
+        fprintf(stderr, "usage: %s [--server SOCKET]\n", argv[0]);
+        return 1;
+    }
+
+    myshell_loop();
+    return 0;
+}
@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include "multios.h"
+#include "pipes.h"
+#include "my_shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define CHUNK (1 << 20)
+
+typedef struct Target
+{
+    int fd;
+    int scratch[2]; // tee needs a pipe on both sides, files are fed from here
+    char copy;      // splice refused (O_APPEND file), fall back to write
+    char dead;      // write failed, e.g. the next stage is gone
+} Target;
+
+static int
+is_output(redirection *r, int fd)
+{
+    return r->type == REDIR_FILE && r->fd_source == fd && (r->flags & O_ACCMODE) == O_WRONLY;
+}
+
+/*
+ *  Move exactly len bytes from the scratch pipe to the target
+ */
+
+static void
+drain(Target *t, size_t len)
+{
+    char buf[65536];
+    ssize_t n;
+
+    while(len > 0 && !t->copy)
+    {
+        n = splice(t->scratch[0], NULL, t->fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if(n > 0)
+            len -= n;
+        else if(n < 0 && errno == EINVAL)
+            t->copy = 1;
+        else if(n < 0 && errno != EINTR)
+            break;
+    }
+
+    while(len > 0 && t->copy)
+    {
+        n = read(t->scratch[0], buf, len < sizeof(buf) ? len : sizeof(buf));
+        if(n <= 0)
+            break;
+        len -= n;
+        for(ssize_t off = 0, w; off < n; off += w)
+            if((w = write(t->fd, buf + off, n - off)) < 0)
+            {
+                t->dead = 1;
+                break;
+            }
+    }
+
+    if(len > 0)
+        t->dead = 1; // what is left in its scratch pipe is never read
+}
+
+/*
+ *  tee copies page references from the start of in without consuming
+ *  them. Every scratch pipe is empty and as large as in, so each tee of
+ *  len returns len. Only then are the bytes consumed from in.
+ */
+
+static void
+fanout_main(int in, Target *targets, int count)
+{
+    int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    int lead;
+    ssize_t n;
+
+    for(;;)
+    {
+        for(lead = 0; lead < count && targets[lead].dead; lead++){}
+        if(lead == count) // nobody reads any more, let the stage see EPIPE
+            break;
+
+        n = tee(in, targets[lead].scratch[1], CHUNK, 0);
+        if(n == 0)
+            break;
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        for(int i = lead + 1; i < count; i++)
+            if(!targets[i].dead && tee(in, targets[i].scratch[1], n, 0) != n)
+                targets[i].dead = 1;
+
+        for(int i = lead; i < count; i++)
+            if(!targets[i].dead)
+                drain(&targets[i], n);
+
+        for(ssize_t left = n; left > 0; left -= n)
+            if((n = splice(in, NULL, null, NULL, left, SPLICE_F_MOVE)) <= 0)
+                _exit(1);
+    }
+
+    _exit(0);
+}
+
+/*
+ *  [lo, hi]: one close_range, or a close per fd on kernels before 5.9
+ */
+
+static void
+close_between(unsigned lo, unsigned hi)
+{
+    if(lo > hi || syscall(SYS_close_range, lo, hi, 0) == 0 || errno != ENOSYS)
+        return;
+
+    long max = sysconf(_SC_OPEN_MAX);
+    if(max < 0 || max > 65536)
+        max = 65536;
+    for(unsigned fd = lo; fd <= hi && fd < (unsigned)max; fd++)
+        close(fd);
+}
+
+static int
+by_fd(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ *  The fan-out inherits every fd the shell holds. It keeps only its own,
+ *  so no pipe of the job stays open behind the stages' backs: the gaps
+ *  between the kept fds are closed a range at a time.
+ */
+
+static void
+close_others(int in, Target *targets, int count)
+{
+    int *keep = malloc(sizeof(int) * (3 * count + 1));
+    int n = 0;
+    unsigned lo = 3;
+
+    keep[n++] = in;
+    for(int i = 0; i < count; i++)
+    {
+        keep[n++] = targets[i].fd;
+        keep[n++] = targets[i].scratch[0];
+        keep[n++] = targets[i].scratch[1];
+    }
+    qsort(keep, n, sizeof(int), by_fd);
+
+    for(int i = 0; i < n; i++)
+    {
+        if(keep[i] < (int)lo)
+            continue;
+        close_between(lo, keep[i] - 1);
+        lo = keep[i] + 1;
+    }
+    close_between(lo, ~0U);
+    free(keep);
+}
+
+/*
+ *  One fan-out for fd: returns the write end the stage gets as fd, or -1
+ *  to leave p as it is
+ */
+
+static int
+start_fanout(job *j, process *p, int fd, int outfile)
+{
+    Target *targets;
+    int count = 0, in[2];
+    redirection *r, *first = NULL;
+
+    for(r = p->redirs; r; r = r->next)
+        if(is_output(r, fd))
+            count++;
+    if(fd == STDOUT_FILENO && outfile >= 0 && count)
+        count++;
+    if(count < 2)
+        return -1;
+
+    targets = calloc(count, sizeof(Target));
+    count = 0;
+
+    for(r = p->redirs; r; r = r->next)
+    {
+        if(!is_output(r, fd))
+            continue;
+
+        int tfd = open(r->filename, r->flags | O_CLOEXEC, 0644);
+        if(tfd < 0)
+            perror(r->filename);
+        else
+            targets[count++].fd = tfd;
+
+        // the stage itself opens none of them
+        if(first == NULL)
+            first = r;
+        else
+            r->type = REDIR_NONE;
+    }
+    if(fd == STDOUT_FILENO && outfile >= 0)
+        targets[count++].fd = outfile;
+
+    int made = 0;
+    while(made < count && make_pipe(targets[made].scratch) == 0)
+        made++;
+
+    pid_t pid = -1;
+    if(count > 0 && made == count && make_pipe(in) == 0)
+    {
+        pid = fork_relay(j);
+        if(pid == 0)
+        {
+            close(in[1]);
+            close_others(in[0], targets, count);
+            fanout_main(in[0], targets, count);
+        }
+        close(in[0]);
+        if(pid < 0)
+            close(in[1]);
+    }
+
+    for(int i = 0; i < count; i++)
+    {
+        if(targets[i].fd != outfile)
+            close(targets[i].fd);
+        if(i < made)
+        {
+            close(targets[i].scratch[0]);
+            close(targets[i].scratch[1]);
+        }
+    }
+    free(targets);
+
+    if(pid < 0) // the stage opens the first file itself, and fails on it
+        return -1;
+
+    // the first file redirection now points the stage at the fan-out
+    char num[16];
+    snprintf(num, sizeof(num), "%d", in[1]);
+    free(first->filename);
+    first->filename = strdup(num);
+    first->type = REDIR_DUP;
+
+    return in[1];
+}
+
+int
+multios_start(job *j, process *p, int outfile, int *fds)
+{
+    int n = 0;
+
+    for(int fd = 0; fd < SHELL_FD_MIN; fd++)
+    {
+        int w = start_fanout(j, p, fd, fd == STDOUT_FILENO ? outfile : -1);
+        if(w >= 0)
+            fds[n++] = w;
+    }
+
+    return n;
+}
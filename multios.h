@@ -0,0 +1,20 @@
+#ifndef MULTIOS_H
+#define MULTIOS_H
+
+#include "jobcontrol.h"
+
+/*
+ *  Multios: an fd redirected to several files, or stdout redirected and
+ *  piped at once (cmd >a >>b | c), is written to all of them. The stage
+ *  writes into a pipe and a fan-out relay duplicates it with tee(2) and
+ *  moves it on with splice(2), without copying through user space.
+ *
+ *  multios_start is called before the stage is forked with the pipe the
+ *  stage would write to (or -1). It starts the fan-outs, rewrites p's
+ *  redirections to point at them and stores the write ends in fds, to be
+ *  closed by the shell once the stage is forked. Returns their count.
+ */
+
+int multios_start(job *j, process *p, int outfile, int *fds);
+
+#endif
@@ -7,6 +7,25 @@
 #include "sighandler.h"
 #include "jobcontrol.h"
 #include "sighandler.h"
+#include "trace.h"
+#include "stats.h"
+#include "scan.h"
+#include "history.h"
+#include "lineedit.h"
+#include "pathindex.h"
+#include "prompt.h"
+#include "cache.h"
+#include "pipes.h"
+#include "pipestat.h"
+#include "multios.h"
+#include "affinity.h"
+#include "priority.h"
+#include "rlimits.h"
+#include "deadline.h"
+#include "rerun.h"
+#include "readvar.h"
+#include "outbuf.h"
+#include "rcfile.h"
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
@@ -16,6 +35,8 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <time.h>
+#include <sys/resource.h>
 
 // https://github.com/tokenrove/build-your-own-shell/blob/master/stage_1.md
 
@@ -33,29 +54,214 @@ int last_exit_status = -1;
 
 static dyarray my_environ;
 
+/*
+ *  A wait status as $? shows it: the exit code or 128 + the signal, 0
+ *  before anything has run
+ */
+
+int
+exit_code(int status)
+{
+    if(status < 0)
+        return 0;
+
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
 extern char **environ;
 
+/*
+ *  Value of key (len bytes, not NUL terminated), borrowed from the
+ *  shell's environment
+ */
+
+/*
+ *  Variables set by read and mapfile live here, not in the environment:
+ *  they are not exported, so a large mapfile can neither slow down every
+ *  lookup nor push exec past its argument limit. "NAME=value" strings in
+ *  an open addressing table hashed on the name, NULL for empty slots.
+ */
+
+static char **shell_vars;
+static size_t shell_vars_cap, shell_vars_len;
+
+static size_t
+var_hash(const char *key, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for(size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)key[i]) * 0x100000001b3ULL;
+
+    return h;
+}
+
+// slot holding key, or the empty slot where it would go
+static size_t
+var_slot(const char *key, size_t len)
+{
+    size_t i = var_hash(key, len) & (shell_vars_cap - 1);
+
+    while(shell_vars[i] && (strncmp(shell_vars[i], key, len) || shell_vars[i][len] != '='))
+        i = (i + 1) & (shell_vars_cap - 1);
+
+    return i;
+}
+
+static void
+grow_vars()
+{
+    char **old = shell_vars;
+    size_t old_cap = shell_vars_cap;
+
+    shell_vars_cap = old_cap ? old_cap * 2 : 64;
+    shell_vars = calloc(shell_vars_cap, sizeof(char *));
+
+    for(size_t i = 0; i < old_cap; i++)
+        if(old[i])
+            shell_vars[var_slot(old[i], strcspn(old[i], "="))] = old[i];
+    free(old);
+}
+
+// backward shift keeps every probe sequence unbroken, no tombstones
+static void
+drop_var(const char *key, size_t len)
+{
+    if(!shell_vars_len)
+        return;
+
+    size_t i = var_slot(key, len), j = i;
+    if(!shell_vars[i])
+        return;
+
+    free(shell_vars[i]);
+    shell_vars[i] = NULL;
+    shell_vars_len--;
+
+    for(;;)
+    {
+        j = (j + 1) & (shell_vars_cap - 1);
+        if(!shell_vars[j])
+            return;
+
+        size_t home = var_hash(shell_vars[j], strcspn(shell_vars[j], "=")) & (shell_vars_cap - 1);
+        if(((j - home) & (shell_vars_cap - 1)) >= ((j - i) & (shell_vars_cap - 1)))
+        {
+            shell_vars[i] = shell_vars[j];
+            shell_vars[j] = NULL;
+            i = j;
+        }
+    }
+}
+
 char *
-get_environ(char* key)
+find_environ(const char *key, size_t len)
 {
-    size_t len = strlen(key);
+    rc_lookup(key, len);
 
     for(int i = 0; my_environ.str[i]; i++)
         if(!strncmp(my_environ.str[i], key, len) && my_environ.str[i][len] == '=')
-            return strdup(&my_environ.str[i][len + 1]);
+            return &my_environ.str[i][len + 1];
+
+    if(shell_vars_len)
+    {
+        char *var = shell_vars[var_slot(key, len)];
+        if(var)
+            return &var[len + 1];
+    }
 
     return NULL;
 }
 
+/*
+ *  NAME=value for read and mapfile: a name already in the environment
+ *  stays exported, anything else becomes a shell variable. A NULL value
+ *  unsets a shell variable.
+ */
+
 void
-init_shell()
+set_var(const char *name, const char *value)
+{
+    size_t len = strlen(name);
+
+    if(value == NULL)
+    {
+        drop_var(name, len);
+        return;
+    }
+
+    char *var = malloc(len + strlen(value) + 2);
+
+    sprintf(var, "%s=%s", name, value);
+
+    for(int i = 0; my_environ.str[i]; i++)
+        if(!strncmp(my_environ.str[i], name, len) && my_environ.str[i][len] == '=')
+        {
+            free(my_environ.str[i]);
+            my_environ.str[i] = var;
+            return;
+        }
+
+    if((shell_vars_len + 1) * 10 > shell_vars_cap * 7)
+        grow_vars();
+
+    size_t i = var_slot(name, len);
+    if(shell_vars[i])
+        free(shell_vars[i]);
+    else
+        shell_vars_len++;
+    shell_vars[i] = var;
+}
+
+char *
+get_environ(char* key)
+{
+    char *value = find_environ(key, strlen(key));
+    return value ? strdup(value) : NULL;
+}
+
+void
+init_environ()
 {
-    shell_terminal = STDERR_FILENO;
-    shell_is_interactive = isatty(shell_terminal);
     init_dyarray(&my_environ);
     
     for(int i = 0; environ[i]; i++)
         append_dyarray(&my_environ, environ[i]);
+}
+
+/*
+ *  $HISTFILE, or ~/.myshell_history
+ */
+
+static void
+open_history()
+{
+    const char *path = find_environ("HISTFILE", 8);
+    const char *home = find_environ("HOME", 4);
+    dystring ds;
+
+    init_dystring(&ds);
+    if(path && path[0])
+        merge_dystring(&ds, path);
+    else if(home)
+    {
+        merge_dystring(&ds, home);
+        merge_dystring(&ds, "/.myshell_history");
+    }
+
+    if(ds.curr_size)
+        history_open(ds.string);
+    free_dystring(&ds);
+}
+
+void
+init_shell()
+{
+    shell_terminal = STDERR_FILENO;
+    shell_is_interactive = isatty(STDIN_FILENO) && isatty(shell_terminal);
+    stats_init();
+    scan_init();
+    init_environ();
 
     if(shell_is_interactive)
     {
@@ -78,20 +284,28 @@ init_shell()
 
         tcsetpgrp(shell_terminal, shell_pgid);
         tcgetattr(shell_terminal, &shell_tmodes);
-
-        signal_wrapper(SIGCHLD, sigchld_handler);
-        sigemptyset(&mask_chld);
-        sigaddset(&mask_chld, SIGCHLD);
-        sigprocmask(SIG_UNBLOCK, &mask_chld, NULL);
+        pathindex_start(find_environ("PATH", 4));
+        lineedit_set_notify(prompt_init(), prompt_update);
     }
+
+    lineedit_set_timer(deadline_init(), deadline_expire);
+    atexit(outbuf_flush_all);
+
+    // scripts wait for their jobs the same way, through sigsuspend
+    signal_wrapper(SIGCHLD, sigchld_handler);
+    sigemptyset(&mask_chld);
+    sigaddset(&mask_chld, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &mask_chld, NULL);
+
+    rc_load();
+    if(shell_is_interactive)
+        open_history(); // after the rc, which may set HISTFILE
 }
 
 /*
  *  Start of the shell
  */
 
-static int exec_sep(char *str);
-
 void
 myshell_loop()
 {
@@ -100,26 +314,43 @@ myshell_loop()
     do
     {
         do_job_notification();
-        printf("< ");
         char *line;
-        while(!((line) = readline())){}
+        if(shell_is_interactive)
+        {
+            outbuf_flush_all();
+            line = lineedit(prompt_begin());
+        }
+        else
+            while(!((line) = readline())){}
+        STAT_INC(lines_parsed);
+
+        if(line == NULL || (!line[0] && feof(stdin))) // Ctrl-D or end of script
+        {
+            free(line);
+            cleanup_all();
+            exit(exit_code(last_exit_status)); // 128 + signal when the last job was killed
+        }
+
+        if(shell_is_interactive)
+            history_add(line);
 
         if(strncmp(line, "jobs", 4) == 0)
         {
-            job *j = first_job;
-            for(; j; j = j->next)
-                format_job_info(j, (j->first_process->stopped) ? "stopped" : "running");
+            list_jobs(strstr(line, "-v") != NULL);
+            STAT_INC(builtins);
         }
         else if(strncmp(line, "fg", 2) == 0)
         {
             pid_t pgid = atoi(&line[3]);
             job *j = find_job(pgid);
+            STAT_INC(builtins);
             continue_job(j, 1);
         }
         else if(strncmp(line, "bg", 2) == 0)
         {
             pid_t pgid = atoi(&line[3]);
             job *j = find_job(pgid);
+            STAT_INC(builtins);
             continue_job(j, 0);
         }
         else
@@ -136,10 +367,13 @@ myshell_loop()
 
 static int exec_logic(char *str, int foreground);
 
-static int
+int
 exec_sep(char *str)
 {
+    uint64_t start = TRACE_START();
+    uint64_t parse_start = TRACE_START();
     SepNode *curr = parse_sep(str);
+    TRACE_END("parse_sep", parse_start, "bytes", (long)strlen(str));
     SepNode *head = curr;
     int res = 0;
 
@@ -147,6 +381,7 @@ exec_sep(char *str)
         res = exec_logic(curr->cmd, (curr->sync) ? 1 : 0);
 
     free_sep_list(head);
+    TRACE_END("exec_sep", start, "status", res);
     return res;
 }
 
@@ -159,7 +394,10 @@ static int exec_job(char *str, int foreground);
 static int
 exec_logic(char *str, int foreground)
 {
+    uint64_t start = TRACE_START();
+    uint64_t parse_start = TRACE_START();
     LogicNode *curr = parse_logic(str);
+    TRACE_END("parse_logic", parse_start, "bytes", (long)strlen(str));
     LogicNode *head = curr;
     int last_status = 0;
     int skip = 0;
@@ -175,10 +413,55 @@ exec_logic(char *str, int foreground)
     }
 
     free_logic_list(head);
+    TRACE_END("exec_logic", start, "status", last_status);
     return last_status;
 }
 
-static void update_environ(char *envp);
+
+static uint64_t fork_ns; // read by the child to measure fork to exec
+
+/*
+ *  Applied in the child before exec, or to the shell itself by exec.
+ *  -1 once a file cannot be opened, the rest are left alone.
+ */
+
+static int
+apply_redirections(redirection *r)
+{
+    for(; r; r = r->next)
+    {
+        int fd;
+
+        if(r->type == REDIR_FILE)
+        {
+            fd = open(r->filename, r->flags, 0644);
+            if(fd < 0)
+            {
+                perror(r->filename);
+                return -1;
+            }
+            if(fd != r->fd_source) // open may hand back the target itself
+            {
+                dup2(fd, r->fd_source);
+                close(fd);
+            }
+        }
+        else if(r->type == REDIR_DUP)
+        {
+            if(dup2(atoi(r->filename), r->fd_source) < 0) // e.g. >&3 after exec 3>&-
+            {
+                perror(r->filename);
+                return -1;
+            }
+        }
+        else if(r->type == REDIR_CLOSE)
+        {
+            close(r->fd_source);
+        }
+    }
+
+    return 0;
+}
 
 void
 launch_process(process *p, pid_t pgid,
@@ -186,6 +469,9 @@ launch_process(process *p, pid_t pgid,
                int foreground)
 {
     pid_t pid;
+    uint64_t start = TRACE_START();
+
+    trace_after_fork();
 
     if(shell_is_interactive)
     {
@@ -212,34 +498,15 @@ launch_process(process *p, pid_t pgid,
         close(errfile);
     }
 
-    redirection *r;
+    if(apply_redirections(p->redirs) < 0)
+        exit(1);
 
-    for(r = p->redirs; r; r = r->next)
-    {
-        int fd;
-
-        if(r->type == REDIR_FILE)
-        {
-            fd = open(r->filename, r->flags, 0644);
-            if(fd < 0){
-                perror("open");
-                exit(1);
-            }
-            dup2(fd, r->fd_source);
-            close(fd);
-        }
-        else if(r->type == REDIR_DUP)
-        {
-            dup2(atoi(r->filename), r->fd_source);
-        }
-        else // r->type == REDIR_CLOSE
-        {
-            close(r->fd_source);
-        }
-    }
+    affinity_apply();
+    limits_apply();
+    priority_apply();
 
     // already after fork
-    for(int i = 0; p->envp[i]; i++)
+    for(int i = 0; p->envp && p->envp[i]; i++)
         update_environ(p->envp[i]);
     
     sigprocmask(SIG_SETMASK, &prev_chld, NULL);
@@ -252,6 +519,7 @@ launch_process(process *p, pid_t pgid,
     if(!p->argv[1] && p->argv[0][0] == '(') // subshell  .. | ( foo ...) | ..
     {
         shell_is_interactive = 0;
+        deadline_init(); // the parent's deadlines stay with the parent
         char *sub_cmd = p->argv[0];
         int len = strlen(sub_cmd);
 
@@ -264,29 +532,75 @@ launch_process(process *p, pid_t pgid,
         exit(res);
     }
 
+    if(!strcmp(p->argv[0], "cat")) // plain cat splices in this child, no exec
+    {
+        int res = pipe_cat(p->argv);
+        if(res >= 0)
+        {
+            STAT_INC(builtins);
+            TRACE_END("cat", start, "pid", (long)getpid());
+            trace_flush();
+            _exit(res); // exit() would seek the shell's stdin back
+        }
+    }
+
+    TRACE_END("exec", start, "pid", (long)getpid());
+    trace_flush();
+    STAT_INC(execs);
+    stats_record(&shell_stats->fork_exec, stats_now() - fork_ns);
+    if(p->path) // stale entries fall through to the PATH search
+        execve(p->path, p->argv, my_environ.str);
     execvpe(p->argv[0], p->argv, my_environ.str);
     perror("execvp"); // should not reach here
     exit(1);
 }
 
+/*
+ *  Look argv[0] up in the PATH index now, so the child execs it without
+ *  searching PATH. Skipped for paths, subshells and a PATH=... prefix.
+ */
+
+static void
+resolve_command(process *p)
+{
+    char *cmd = p->argv[0];
+
+    if(cmd == NULL || cmd[0] == '(' || strchr(cmd, '/'))
+        return;
+
+    for(int i = 0; p->envp && p->envp[i]; i++)
+        if(!strncmp(p->envp[i], "PATH=", 5))
+            return;
+
+    p->path = pathindex_lookup(cmd);
+}
+
 void
 launch_job(job *j, int foreground)
 {
     process *p;
     pid_t pid;
-    int mypipe[2], infile, outfile;
+    int mypipe[2], infile, outfile, link, stage = 0;
     infile = j->stdin;
+    uint64_t start = TRACE_START();
 
+    rc_job();
+    outbuf_flush_all(); // the children write after everything before them
     sigprocmask(SIG_BLOCK, &mask_chld, &prev_chld);
     // add job
     j->next = first_job;
     first_job = j;
-    
-    for(p = j->first_process; p; p = p->next)
+    clock_gettime(CLOCK_MONOTONIC, &j->start);
+    pipestat_attach(j);
+    affinity_begin(j);
+    limits_begin(j);
+    priority_begin(j, foreground);
+
+    for(p = j->first_process, link = 0; p; p = p->next)
     {
         if(p->next)
         {
-            if(pipe(mypipe) < 0)
+            if(make_pipe(mypipe) < 0)
             {
                 perror("pipe");
                 exit(1);
@@ -297,6 +611,14 @@ launch_job(job *j, int foreground)
         else
             outfile = j->stdout;
         
+        resolve_command(p);
+        affinity_stage(stage++);
+        int fanout[SHELL_FD_MIN];
+        int num_fanout = multios_start(j, p, p->next ? outfile : -1, fanout);
+        clock_gettime(CLOCK_MONOTONIC, &p->start);
+        uint64_t fork_start = TRACE_START();
+        fork_ns = stats_now();
+        STAT_INC(forks);
         pid = fork();
         if(pid == 0)
             launch_process(p, j->pgid, infile, outfile, j->stderr, foreground);
@@ -307,6 +629,7 @@ launch_job(job *j, int foreground)
         }
         else
         {
+            TRACE_END("fork", fork_start, "pid", (long)pid);
             p->pid = pid;
             if(shell_is_interactive)
             {
@@ -318,21 +641,29 @@ launch_job(job *j, int foreground)
 
         if(infile != j->stdin)   close(infile);
         if(outfile != j->stdout) close(outfile);
+        for(int i = 0; i < num_fanout; i++)
+            close(fanout[i]);
         infile = mypipe[0];
+        if(p->next && j->pipestat)
+            infile = pipestat_relay(j, link++, infile);
     }
+    priority_end();
+    deadline_start(j);
     format_job_info(j, "launched");
+    TRACE_END("launch_job", start, "pgid", (long)j->pgid);
 
-    if(!shell_is_interactive)
+    if(!foreground)
+        put_job_in_background(j, 0);
+    else if(!shell_is_interactive)
         wait_for_job(j);
-    else if(foreground)
-        put_job_in_foreground(j, 0);
     else
-        put_job_in_background(j, 0);
+        put_job_in_foreground(j, 0);
 
+    outbuf_flush(STDERR_FILENO);
     sigprocmask(SIG_SETMASK, &prev_chld, NULL);
 }
 
-static void
+void
 update_environ(char *envp)
 {
     char *var = malloc(sizeof(char) * 4096);
@@ -352,14 +683,17 @@ update_environ(char *envp)
             return;
         }
     
-    // new var
+    // new var, exported from now on
+    drop_var(envp, i);
     append_dyarray(&my_environ, envp);
     free(var);
 }
 
 static int
-do_cd(char *target)
+do_cd(char **argv)
 {
+    char *target = argv[1];
+
     if(!target)
         for(int i = 0; my_environ.str[i]; i++)
             if(!strncmp(my_environ.str[i], "HOME=", 5))
@@ -379,42 +713,462 @@ do_cd(char *target)
     snprintf(new_pwd, sizeof(new_pwd), "PWD=%s", cwd);
     update_environ(new_pwd);
     
+    return res < 0 ? 1 << 8 : 0;
+}
+
+/*
+ *  echo [-neE] args, written through the output buffer: a script's run
+ *  of echos costs a few large writes, not one each
+ */
+
+static int
+do_echo(char **argv)
+{
+    int i, newline = 1, escapes = 0;
+    dystring ds;
+
+    for(i = 1; argv[i] && argv[i][0] == '-' && argv[i][1] &&
+        strspn(argv[i] + 1, "neE") == strlen(argv[i] + 1); i++)
+        for(char *f = argv[i] + 1; *f; f++)
+        {
+            if(*f == 'n')
+                newline = 0;
+            else
+                escapes = *f == 'e';
+        }
+
+    init_dystring(&ds);
+    for(int first = i; argv[i]; i++)
+    {
+        if(i > first)
+            append_dystring(&ds, ' ');
+        if(!escapes)
+        {
+            merge_dystring(&ds, argv[i]);
+            continue;
+        }
+
+        for(char *c = argv[i]; *c; c++)
+        {
+            const char *plain = "\\\\a\ab\bf\fn\nr\rt\tv\v"; // letter, then its byte
+            const char *e;
+
+            if(*c != '\\' || !c[1])
+                append_dystring(&ds, *c);
+            else if(c[1] == 'c') // no more output
+            {
+                int res = outbuf_write(STDOUT_FILENO, ds.string, ds.curr_size);
+                free_dystring(&ds);
+                return res < 0 ? 1 << 8 : 0;
+            }
+            else if(c[1] == '0')
+            {
+                int n = 0, k;
+                for(k = 2; k < 5 && c[k] >= '0' && c[k] <= '7'; k++)
+                    n = n * 8 + c[k] - '0';
+                append_dystring(&ds, n);
+                c += k - 1;
+            }
+            else if((e = strchr(plain, c[1])) && (e - plain) % 2 == 0)
+            {
+                append_dystring(&ds, e[1]);
+                c++;
+            }
+            else
+                append_dystring(&ds, *c);
+        }
+    }
+    if(newline)
+        append_dystring(&ds, '\n');
+
+    int res = outbuf_write(STDOUT_FILENO, ds.string, ds.curr_size);
+    free_dystring(&ds);
+
+    return res < 0 ? 1 << 8 : 0;
+}
+
+/*
+ *  times: accumulated user and system time of the shell and of its
+ *  reaped children
+ */
+
+static void
+print_tv(struct timeval *tv)
+{
+    printf("%ldm%ld.%03lds", (long)tv->tv_sec / 60, (long)tv->tv_sec % 60,
+           (long)tv->tv_usec / 1000);
+}
+
+static int
+do_times(char **argv)
+{
+    struct rusage self, children;
+    (void)argv;
+
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    print_tv(&self.ru_utime);
+    printf(" ");
+    print_tv(&self.ru_stime);
+    printf("\n");
+    print_tv(&children.ru_utime);
+    printf(" ");
+    print_tv(&children.ru_stime);
+    printf("\n");
+
+    return 0;
+}
+
+/*
+ *  set -o name[=value] / set +o name. A bare -o name passes "", +o NULL.
+ */
+
+static int
+set_trace(char *value)
+{
+    if(!value)
+    {
+        trace_close();
+        return 0;
+    }
+    if(!value[0])
+    {
+        fprintf(stderr, "usage: set -o trace=FILE\n");
+        return 2 << 8;
+    }
+
+    return trace_open(value) < 0 ? 1 << 8 : 0;
+}
+
+typedef struct ShellOption
+{
+    char *name;
+    int (*set)(char *value); // value is NULL for +o, returns a wait status
+} ShellOption;
+
+static ShellOption shell_options[] = {
+    {"trace",    set_trace},
+    {"pipesize", set_pipesize},
+    {"pipestat", set_pipestat},
+    {"affinity", set_affinity},
+    {"bgnice",   set_bgnice},
+    {"jobtimeout", set_jobtimeout},
+    {NULL, NULL}
+};
+
+static int
+do_set(char **argv)
+{
+    if(!argv[1] || !argv[2] || (strcmp(argv[1], "-o") && strcmp(argv[1], "+o")))
+    {
+        fprintf(stderr, "usage: set -o name[=value] | set +o name\n");
+        return 2 << 8;
+    }
+
+    char *name = argv[2];
+    char *value = strchr(name, '=');
+    size_t len = value ? (size_t)(value - name) : strlen(name);
+
+    if(argv[1][0] == '+')
+        value = NULL;
+    else if(value)
+        value++;
+    else
+        value = "";
+
+    for(int i = 0; shell_options[i].name; i++)
+        if(strlen(shell_options[i].name) == len && !strncmp(shell_options[i].name, name, len))
+            return shell_options[i].set(value);
+
+    fprintf(stderr, "set: %.*s: unknown option\n", (int)len, name);
+    return 1 << 8;
+}
+
+static int
+do_shellstats(char **argv)
+{
+    int json = argv[1] && (!strcmp(argv[1], "-j") || !strcmp(argv[1], "--json"));
+    stats_print(json);
+    return 0;
+}
+
+/*
+ *  wait: block until every job has completed or stopped
+ */
+
+static int
+do_wait(char **argv)
+{
+    (void)argv;
+    sigprocmask(SIG_BLOCK, &mask_chld, &prev_chld);
+
+    for(job *j = first_job; j; j = j->next)
+        wait_for_job(j);
+
+    sigprocmask(SIG_SETMASK, &prev_chld, NULL);
+    do_job_notification();
+    return 0;
+}
+
+/*
+ *  fds 0-9 belong to the user (exec 3>log, >&3). Anything the shell keeps
+ *  open for itself is moved to SHELL_FD_MIN or above, close-on-exec, so
+ *  exec never clobbers it and commands never inherit it.
+ *
+ *  Main thread only: an exec 3>log landing between the open and the
+ *  close here would lose the user's fd.
+ */
+
+int
+shell_fd(int fd)
+{
+    if(fd < 0 || fd >= SHELL_FD_MIN)
+        return fd;
+
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_MIN);
+    if(high < 0)
+        perror("shell_fd");
+    close(fd);
+    return high;
+}
+
+/*
+ *  exec cmd args: replace the shell with cmd
+ *  exec 3>>log 4<input 3>&-: redirect the shell's own fds, which every
+ *  later command inherits
+ */
+
+static int
+do_exec(process *p)
+{
+    for(redirection *r = p->redirs; r; r = r->next)
+        if(r->type != REDIR_NONE && (r->fd_source >= SHELL_FD_MIN ||
+           (r->type == REDIR_DUP && atoi(r->filename) >= SHELL_FD_MIN)))
+        {
+            fprintf(stderr, "exec: fds from %d up are reserved for the shell\n", SHELL_FD_MIN);
+            return 1 << 8;
+        }
+
+    outbuf_flush_all();
+    if(apply_redirections(p->redirs) < 0)
+        return 1 << 8;
+
+    if(p->argv[1])
+    {
+        for(int i = 0; p->envp && p->envp[i]; i++)
+            update_environ(p->envp[i]);
+        trace_flush();
+        execvpe(p->argv[1], &p->argv[1], my_environ.str);
+        perror(p->argv[1]);
+        return 127 << 8;
+    }
+
+    return 0;
+}
+
+static int
+do_exit(char **argv)
+{
+    (void)argv;
+    cleanup_all();
+    exit(0);
+}
+
+/*
+ *  Builtins run in the shell itself when they are not part of a pipeline.
+ *  They return a wait status, as a job would end with (1 << 8 for exit
+ *  1), and the caller makes it $?.
+ */
+
+typedef struct Builtin
+{
+    char *name;
+    int (*func)(char **argv);
+} Builtin;
+
+static Builtin builtins[] = {
+    {"cd",         do_cd},
+    {"echo",       do_echo},
+    {"times",      do_times},
+    {"set",        do_set},
+    {"shellstats", do_shellstats},
+    {"wait",       do_wait},
+    {"cache",      do_cache},
+    {"ulimit",     do_ulimit},
+    {"rerun",      do_rerun},
+    {"read",       do_read},
+    {"mapfile",    do_mapfile},
+    {"readarray",  do_mapfile},
+    {"quit",       do_exit},
+    {"exit",       do_exit},
+    {NULL, NULL}
+};
+
+/*
+ *  A builtin's redirections (read line < file, times > log) last for
+ *  the builtin only: every fd they touch is saved above SHELL_FD_MIN
+ *  first and put back after.
+ *
+ *  An fd sent to several files (echo hi >a >b) goes through a multios
+ *  fan-out as it would for a command. The fan-out ends once the fds are
+ *  put back, and is waited for so the files are complete after the
+ *  builtin.
+ */
+
+static int *builtin_saved; // while a builtin with redirections runs
+
+int
+builtin_redirected(int fd)
+{
+    return builtin_saved && fd >= 0 && fd < SHELL_FD_MIN && builtin_saved[fd] != -2;
+}
+
+static int
+run_builtin(Builtin *b, job *j, process *p)
+{
+    int saved[SHELL_FD_MIN], fanout[SHELL_FD_MIN];
+    int res;
+
+    if(b->func != do_echo)
+        outbuf_flush_all(); // the others print through stdio
+    if(!p->redirs)
+        return b->func(p->argv);
+
+    for(int fd = 0; fd < SHELL_FD_MIN; fd++)
+        saved[fd] = -2; // untouched
+    for(redirection *r = p->redirs; r; r = r->next)
+    {
+        if(r->type == REDIR_NONE)
+            continue;
+        if(r->fd_source >= SHELL_FD_MIN || (r->type == REDIR_DUP && atoi(r->filename) >= SHELL_FD_MIN))
+        {
+            fprintf(stderr, "%s: fds from %d up are reserved for the shell\n", p->argv[0], SHELL_FD_MIN);
+            return 1 << 8;
+        }
+        if(saved[r->fd_source] == -2)
+            saved[r->fd_source] = fcntl(r->fd_source, F_DUPFD_CLOEXEC, SHELL_FD_MIN); // -1: was closed
+    }
+
+    outbuf_flush_all();
+    int num_fanout = multios_start(j, p, -1, fanout);
+    builtin_saved = saved;
+    res = apply_redirections(p->redirs);
+    for(int i = 0; i < num_fanout; i++)
+        close(fanout[i]);
+    if(res < 0)
+        res = 1 << 8;
+    else
+        res = b->func(p->argv);
+    builtin_saved = NULL;
+
+    // echo > /dev/full fails as /bin/echo would
+    if(outbuf_flush(STDOUT_FILENO) < 0 && res == 0)
+        res = 1 << 8;
+    outbuf_flush_all();
+
+    // the fan-outs see end of input as the fds are put back
+    sigprocmask(SIG_BLOCK, &mask_chld, &prev_chld);
+    for(int fd = 0; fd < SHELL_FD_MIN; fd++)
+    {
+        if(saved[fd] == -2)
+            continue;
+        if(saved[fd] < 0)
+            close(fd);
+        else
+        {
+            dup2(saved[fd], fd);
+            close(saved[fd]);
+        }
+    }
+    for(process *r = j->relays; r; r = r->next)
+        waitpid(r->pid, NULL, 0);
+    sigprocmask(SIG_SETMASK, &prev_chld, NULL);
+
     return res;
 }
 
+/*
+ *  A builtin by name with argv as it is, for the rc snapshot replay
+ */
+
+int
+call_builtin(char **argv)
+{
+    for(int i = 0; builtins[i].name; i++)
+        if(!strcmp(argv[0], builtins[i].name))
+            return builtins[i].func(argv);
+
+    return 127 << 8;
+}
+
 static int
 exec_job(char *str, int foreground)
 {
+    uint64_t start = TRACE_START();
     job *j = parse_job(str);
+    TRACE_END("parse_job", start, "bytes", (long)strlen(str));
+
+    if(!j->first_process) // bare "time"
+    {
+        freejob(j);
+        return 0;
+    }
+
+    if(limits_check(j) < 0 || deadline_check(j) < 0)
+    {
+        freejob(j);
+        last_exit_status = 2 << 8;
+        return last_exit_status;
+    }
 
     if(j->first_process->next == NULL) // not a pipeline
     {
         process *p = j->first_process;
         char *cmd = p->argv[0];
 
-        if(cmd == NULL) // new env var
+        if(cmd == NULL && p->envp == NULL) // blank
         {
-            update_environ(j->first_process->envp[0]); // borrowing
             freejob(j);
             return 0;
         }
 
-        if(strcmp(cmd, "cd") == 0)
+        if(cmd == NULL) // new env var
         {
-            do_cd(p->argv[1]);
+            update_environ(j->first_process->envp[0]); // borrowing
+            rc_assign(j->first_process->envp[0]);
+            if(!strncmp(j->first_process->envp[0], "PATH=", 5))
+                pathindex_set_path(j->first_process->envp[0] + 5);
             freejob(j);
             return 0;
         }
-        else if(strcmp(cmd, "quit") == 0 || strcmp(cmd, "exit") == 0)
+
+        if(strcmp(cmd, "exec") == 0) // needs the redirections, not just argv
         {
-            cleanup_all();
-            exit(0);
+            STAT_INC(builtins);
+            rc_job();
+            int res = do_exec(p);
+            last_exit_status = res;
+            freejob(j);
+            return res;
         }
+
+        for(int i = 0; builtins[i].name; i++)
+            if(strcmp(cmd, builtins[i].name) == 0)
+            {
+                STAT_INC(builtins);
+                rc_builtin(p);
+                int res = run_builtin(&builtins[i], j, p);
+                last_exit_status = res; // nothing forked, $? comes from here
+                freejob(j);
+                return res;
+            }
     }
 
     launch_job(j, foreground);
-    int status = j->status;
+    int status = j->timed_out ? 124 << 8 : j->status; // as timeout(1)
     last_exit_status = status;
     do_job_notification();
+    TRACE_END("exec_job", start, "status", status);
     return status;
 }
\ No newline at end of file
@@ -14,6 +14,20 @@ extern sigset_t mask_chld, prev_chld;
 extern int last_exit_status;
 
 void myshell_loop();
+void init_shell();
+int exec_sep(char *str);
+int exit_code(int status);
+void launch_job(job *j, int foreground);
+void update_environ(char *envp);
+
+#define SHELL_FD_MIN 10 // fds below are the user's, see shell_fd
+
+int shell_fd(int fd);
+void init_environ();
 char *get_environ(char* key);
+char *find_environ(const char *key, size_t len);
+void set_var(const char *name, const char *value);
+int builtin_redirected(int fd);
+int call_builtin(char **argv);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "outbuf.h"
+#include "my_shell.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+typedef struct OutBuf
+{
+    char *data; // OUTBUF_SIZE bytes once used
+    size_t len;
+} OutBuf;
+
+static OutBuf out[SHELL_FD_MIN]; // fds the shell keeps for itself are never buffered
+
+static int
+write_all(int fd, const char *s, size_t len)
+{
+    while(len)
+    {
+        ssize_t n = write(fd, s, len);
+
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return -1;
+        STAT_INC(output_writes);
+        s += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static void
+flush_stdio(int fd)
+{
+    if(fd == STDOUT_FILENO)
+        fflush(stdout);
+    else if(fd == STDERR_FILENO)
+        fflush(stderr);
+}
+
+/*
+ *  -1 if the write failed, the pending bytes are dropped either way
+ */
+
+int
+outbuf_flush(int fd)
+{
+    if(fd < 0 || fd >= SHELL_FD_MIN || out[fd].len == 0)
+        return 0;
+
+    int res = write_all(fd, out[fd].data, out[fd].len);
+    out[fd].len = 0;
+
+    return res;
+}
+
+void
+outbuf_flush_all()
+{
+    fflush(stdout);
+    fflush(stderr);
+    for(int fd = 0; fd < SHELL_FD_MIN; fd++)
+        outbuf_flush(fd);
+}
+
+/*
+ *  -1 if a write made on the way failed. Bytes only buffered report
+ *  theirs from the flush that writes them.
+ */
+
+int
+outbuf_write(int fd, const char *s, size_t len)
+{
+    int res = 0;
+
+    if(fd < 0 || fd >= SHELL_FD_MIN)
+        return write_all(fd, s, len);
+
+    OutBuf *b = &out[fd];
+
+    if(b->len == 0)
+        flush_stdio(fd);
+    if(b->len + len > OUTBUF_SIZE)
+        res = outbuf_flush(fd);
+    if(len >= OUTBUF_SIZE) // too big to gain from a copy
+        return write_all(fd, s, len) < 0 ? -1 : res;
+
+    if(b->data == NULL)
+        b->data = malloc(OUTBUF_SIZE);
+    memcpy(b->data + b->len, s, len);
+    b->len += len;
+
+    return res;
+}
+
+void
+outbuf_printf(int fd, const char *fmt, ...)
+{
+    char buf[1024];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if(n < 0)
+        return;
+    if((size_t)n < sizeof(buf))
+    {
+        outbuf_write(fd, buf, n);
+        return;
+    }
+
+    char *big = malloc(n + 1);
+    va_start(ap, fmt);
+    vsnprintf(big, n + 1, fmt, ap);
+    va_end(ap);
+    outbuf_write(fd, big, n);
+    free(big);
+}
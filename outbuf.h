@@ -0,0 +1,24 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+
+/*
+ *  Output the shell writes itself (echo, job notifications) is gathered
+ *  per fd and written in large blocks. Everything pending is flushed
+ *  before a fork, before the shell blocks waiting on a job or for input,
+ *  around a builtin's redirections and at exit, so it always lands
+ *  before anything a later child writes.
+ *
+ *  stdout and stderr stdio buffers are flushed ahead of the fd's own, so
+ *  text written either way keeps its order.
+ */
+
+#define OUTBUF_SIZE 65536
+
+int outbuf_write(int fd, const char *s, size_t len);
+void outbuf_printf(int fd, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int outbuf_flush(int fd);
+void outbuf_flush_all();
+
+#endif
@@ -11,10 +11,14 @@
 #include <string.h>
 #include "jobcontrol.h"
 #include "my_shell.h"
+#include "trace.h"
+#include "stats.h"
+#include "expand.h"
+#include "scan.h"
 
 /*
-    struct and function for passing single quotes, double quotes, and parenthesis
-    quotes have a higher hierarchy comared to parenthesis
+    struct and function for passing single quotes, double quotes, parenthesis
+    and ${...}. quotes have a higher hierarchy comared to parenthesis
 */
 
 typedef struct
@@ -22,11 +26,16 @@ typedef struct
     int in_s;
     int in_d;
     int depth;
+    int brace;  // depth inside ${...}
+    int dollar; // previous character was an unquoted $
 } Scanner;
 
 static int
 update_and_check_protected(Scanner *s, char c)
 {
+    int dollar = s->dollar;
+    s->dollar = 0;
+
     if(c == '\'' && !s->in_d)
     {
         s->in_s = !s->in_s;
@@ -41,6 +50,15 @@ update_and_check_protected(Scanner *s, char c)
 
     if(s->in_s || s->in_d)
         return 1;
+
+    if(s->brace || (c == '{' && dollar))
+    {
+        if(c == '{') s->brace++;
+        if(c == '}') s->brace--;
+        return 1;
+    }
+
+    s->dollar = (c == '$');
     
     if(c == '(') s->depth++;
     if(c == ')') s->depth--;
@@ -51,6 +69,23 @@ update_and_check_protected(Scanner *s, char c)
     return 0;
 }
 
+/*
+    Index of the next byte at or after i that update_and_check_protected
+    or a stage could act on. Bytes skipped over are plain word characters,
+    so the only state they touch is the $ in front of a {.
+*/
+
+static inline int
+next_special(Scanner *s, const char *str, int i, int with_space)
+{
+    int next = scan_special(&str[i], with_space) - str;
+
+    if(next != i)
+        s->dollar = 0;
+
+    return next;
+}
+
 /*
     Code for specifically parsing & (foreground) and ; (background) symbols
 */
@@ -60,6 +95,8 @@ append_sepnode(SepNode **head, char *cmd, char sync)
 {
     SepNode *new_node = malloc(sizeof(SepNode));
     if(new_node == NULL) return;
+    STAT_INC(allocs);
+    STAT_ADD(alloc_bytes, sizeof(SepNode));
 
     new_node->cmd = cmd;
     new_node->sync = sync;
@@ -83,34 +120,36 @@ append_sepnode(SepNode **head, char *cmd, char sync)
 SepNode *
 parse_sep(char *str)
 {
+    uint64_t start = stats_now();
     SepNode *head = NULL;
     dystring ds;
     init_dystring(&ds);
-    Scanner scanner = {0, 0, 0};
+    Scanner scanner = {0, 0, 0, 0, 0};
+    int seg = 0; // start of the current command
+    int i;
 
-    for(int i=0; str[i]; i++)
+    for(i = next_special(&scanner, str, 0, 0); str[i]; i = next_special(&scanner, str, i + 1, 0))
     {
         if(update_and_check_protected(&scanner, str[i]))
-        {
-            append_dystring(&ds, str[i]);
             continue;
-        }
 
-        if(str[i] == ';' || (str[i] == '&' && (str[i+1] != '&' && str[i-1] != '&' && str[i-1] != '<' && str[i+1] != '>')))
+        if(str[i] == ';' || (str[i] == '&' && (str[i+1] != '&' && str[i+1] != '>' &&
+                             (i == 0 || (str[i-1] != '&' && str[i-1] != '<' && str[i-1] != '>')))))
         {
-            append_sepnode(&head, ds.string, str[i] == ';' ? SYNC : ASYNC); // move ownership
-            init_dystring(&ds);
-            continue;
+            append_dystring_n(&ds, &str[seg], i - seg);
+            append_sepnode(&head, steal_dystring(&ds), str[i] == ';' ? SYNC : ASYNC); // move ownership
+            seg = i + 1;
         }
-
-        append_dystring(&ds, str[i]);
     }
 
-    if(ds.curr_size > 0)
-        append_sepnode(&head, ds.string, SYNC); // move ownership
-    else
-        free(ds.string); // or just free
+    if(i > seg)
+    {
+        append_dystring_n(&ds, &str[seg], i - seg);
+        append_sepnode(&head, steal_dystring(&ds), SYNC); // move ownership
+    }
 
+    STAT_ADD(bytes_lexed, i); // once: logic and job parsing go over the same bytes
+    stats_record(&shell_stats->parse, stats_now() - start);
     return head;
 }
 
@@ -137,6 +176,8 @@ append_logicnode(LogicNode **head, char *cmd, LogicType type)
 {
     LogicNode *new_node = malloc(sizeof(LogicNode));
     if(new_node == NULL) return;
+    STAT_INC(allocs);
+    STAT_ADD(alloc_bytes, sizeof(LogicNode));
 
     new_node->cmd = cmd;
     new_node->type = type;
@@ -158,37 +199,37 @@ append_logicnode(LogicNode **head, char *cmd, LogicType type)
 LogicNode *
 parse_logic(char *str)
 {
+    uint64_t start = stats_now();
     LogicNode *head = NULL;
     dystring ds;
     init_dystring(&ds);
-    Scanner scanner = {0, 0, 0};
+    Scanner scanner = {0, 0, 0, 0, 0};
+    int seg = 0;
+    int i;
 
-    for(int i=0; str[i]; i++)
+    for(i = next_special(&scanner, str, 0, 0); str[i]; i = next_special(&scanner, str, i + 1, 0))
     {
         if(update_and_check_protected(&scanner, str[i]))
-        {
-            append_dystring(&ds, str[i]);
             continue;
-        }
 
         if((str[i] == '&' && str[i + 1] == '&') || 
            (str[i] == '|' && str[i + 1] == '|'))
         {
             LogicType type = str[i] == '&' ? LOGIC_AND : LOGIC_OR;
-            append_logicnode(&head, ds.string, type); // move ownership
-            init_dystring(&ds);
+            append_dystring_n(&ds, &str[seg], i - seg);
+            append_logicnode(&head, steal_dystring(&ds), type); // move ownership
             i++; // skip latter char
-            continue;
+            seg = i + 1;
         }
-
-        append_dystring(&ds, str[i]);
     }
 
-    if(ds.curr_size > 0)
-        append_logicnode(&head, ds.string, LOGIC_NONE); // move ownership
-    else
-        free(ds.string); // or free
+    if(i > seg)
+    {
+        append_dystring_n(&ds, &str[seg], i - seg);
+        append_logicnode(&head, steal_dystring(&ds), LOGIC_NONE); // move ownership
+    }
 
+    stats_record(&shell_stats->parse, stats_now() - start);
     return head;
 }
 
@@ -206,7 +247,6 @@ free_logic_list(LogicNode *head)
     }
 }
 
-static char *find_unquoted(char *str, char c);
 static char *find_unquoted_sub(char *str, char* sub);
 
 /*
@@ -231,55 +271,80 @@ is_redirec(char *str)
     redirection operators/fileanmes, and environment variabel declaration
 */
 
+static void
+append_arg(char ***argv, int *arg_idx, int *max_args, char *arg)
+{
+    if(*arg_idx + 1 >= *max_args)
+    {
+        *max_args *= 2;
+        *argv = realloc(*argv, sizeof(char *) * *max_args);
+        STAT_INC(allocs);
+        STAT_ADD(alloc_bytes, sizeof(char *) * *max_args);
+    }
+
+    (*argv)[(*arg_idx)++] = arg;
+}
+
 static char **
-tokenize_process(char *cmd)
+tokenize_process(char *cmd, int *num_args, int *max_out)
 {
     dystring ds;
     init_dystring(&ds);
-    char **argv = malloc(sizeof(char*) * 64);
+    int max_args = 16;
+    char **argv = malloc(sizeof(char*) * max_args);
     int arg_idx = 0;
-    Scanner scanner = {0, 0, 0};
+    STAT_INC(allocs);
+    STAT_ADD(alloc_bytes, sizeof(char *) * max_args);
+    Scanner scanner = {0, 0, 0, 0, 0};
+    int tok = 0;       // start of the current token
+    int has_redir = 0; // current token holds an unquoted < or >, see is_redirec
+    int i;
 
-    for(int i=0; cmd[i]; i++)
+    // right after a redirection operator every byte matters, see below
+    for(i = next_special(&scanner, cmd, 0, 1); cmd[i];
+        i = has_redir ? i + 1 : next_special(&scanner, cmd, i + 1, 1))
     {
         if(update_and_check_protected(&scanner, cmd[i]))
-        {
-            append_dystring(&ds, cmd[i]);
             continue;
-        }
 
-        if(is_redirec(ds.string) && (cmd[i] != '>' && cmd[i] != '<' && cmd[i] != '&'))
+        if(has_redir && (cmd[i] != '>' && cmd[i] != '<' && cmd[i] != '&'))
         {
-            argv[arg_idx++] = ds.string; // ownership moved
-            init_dystring(&ds);
-            continue;
+            append_dystring_n(&ds, &cmd[tok], i - tok);
+            append_arg(&argv, &arg_idx, &max_args, steal_dystring(&ds)); // ownership moved
+            tok = i; // cmd[i] starts the filename (>file) unless it is a space
+            has_redir = 0;
         }
 
         if(isspace(cmd[i]))
         {
-            if(ds.curr_size > 0)
+            if(i > tok)
             {
-                argv[arg_idx++] = ds.string; // move ownership
-                init_dystring(&ds);
+                append_dystring_n(&ds, &cmd[tok], i - tok);
+                append_arg(&argv, &arg_idx, &max_args, steal_dystring(&ds)); // move ownership
             }
+            tok = i + 1;
             continue;
         }
 
-        append_dystring(&ds, cmd[i]);
+        if(cmd[i] == '>' || cmd[i] == '<')
+            has_redir = 1;
     }
 
-    if(ds.curr_size > 0)
-        argv[arg_idx++] = ds.string; // move ownership
-    else
-        free(ds.string); // or free
+    if(i > tok)
+    {
+        append_dystring_n(&ds, &cmd[tok], i - tok);
+        append_arg(&argv, &arg_idx, &max_args, steal_dystring(&ds)); // move ownership
+    }
     
     argv[arg_idx] = NULL;
+    *num_args = arg_idx;
+    *max_out = max_args;
 
     return argv;
 }
 
 /*
-    Struct for redirection cases >, <, >>, <>, &> (&>- for closing), <& 
+    Struct for redirection cases >, <, >>, <>, &> (&>- for closing), <&, >&
 */
 
 typedef struct RedirRule
@@ -290,7 +355,7 @@ typedef struct RedirRule
     int default_fd;
 } RedirRule;
 
-#define NUM_OF_REDIR 6
+#define NUM_OF_REDIR 7
 
 static RedirRule redir_rules[] = {
     {">",  REDIR_FILE, O_WRONLY | O_CREAT | O_TRUNC,  1},
@@ -299,6 +364,7 @@ static RedirRule redir_rules[] = {
     {"<>", REDIR_FILE, O_RDWR | O_CREAT,              0},
     {"<&", REDIR_DUP,  0,                             0},
     {"&>", REDIR_DUP,  0,                             0},
+    {">&", REDIR_DUP,  0,                             1},
     {NULL, 0, 0, 0}
 };
 
@@ -338,10 +404,16 @@ parse_redirec(char *redir, char *filename)
             if(!strncmp(r->filename, "-", 1))
                 r->type = REDIR_CLOSE;
             
-            free(redir); // free operator token. only filename token is needed
             break;
         }
     
+    if(r->type == REDIR_NONE) // e.g. a>b, ignored when launching
+    {
+        fprintf(stderr, "unknown redirection: %s\n", redir);
+        free(filename);
+    }
+
+    free(redir); // free operator token. only filename token is needed
     
     if(!is_fd_default) // overwrite fd
         r->fd_source = sum;
@@ -349,209 +421,148 @@ parse_redirec(char *redir, char *filename)
     return r;
 }
 
-/*
-    Function for parsing environment variables.
-    Two arguments are needed: a pointer that points to the start
-    of the environment variabel KEY, and a pointer that points to the
-    original token.
-    
-    For example if the current token is "aaa/$FOO/bbb",
-    the first argument is "$FOO/bbb", the second is
-    "aaa/$FOO/bbb". if FOO=BAR, the result will be a new string
-    with the value of "aaa/BAR/bbb".
-*/
-
-static void
-expand_env(char **arg)
+static char *
+find_unquoted_sub(char *str, char *sub)
 {
-    char *env_var;
-    char *res = strdup(*arg);
+    Scanner scanner = {0, 0, 0, 0, 0};
+    int i;
 
-    while((env_var = strchr(res, '$')))
+    for(i = next_special(&scanner, str, 0, 0); str[i]; i = next_special(&scanner, str, i + 1, 0))
     {
-        // prefix
-        int pre_len = env_var - res;
-        char *prefix = strdup(res);
-        prefix[pre_len] = '\0';
-        
-        // value
-        env_var = &env_var[1]; // skip $
-        char *value;
-        int var_len = 0;
-
-        if(env_var[0] == '?') // exit status of last pipeline
-        {
-            value = malloc(12);
-            snprintf(value, 12, "%d", last_exit_status);
-            var_len = 1;
-        }
-        else if(env_var[0] == '$') // pid of current process that has terminal control
-        {
-            value = malloc(12);
-            snprintf(value, 12, "%d", (int)getpid());
-            var_len = 1;
-        }
-        else
-        {
-            while(env_var[var_len] && (isalnum(env_var[var_len]) || env_var[var_len] == '_'))
-                var_len++;
-            
-            char *key = strdup(env_var); // dup FOO from ABC$FOO/DEF
-            key[var_len] = '\0'; // only FOO\0 left
-            value = get_environ(key); // malloc value
-            free(key);
-        }
-
-        // suffix
-        char *suffix = strdup(&res[pre_len + var_len + 1]);
-
-        // new string with replaced env
-        dystring *ds = new_dystring(); // malloc ds
+        if(update_and_check_protected(&scanner, str[i]))
+            continue;
         
-        merge_dystring(ds, prefix);
-        merge_dystring(ds, value ? value : "");
-        merge_dystring(ds, suffix);
-        free(prefix);
-        free(value);
-        free(suffix);
-
-        free(res);
-        res = ds->string; // move ownership of ds.string
-        free(ds);
+        if(!strncmp(&str[i], sub, strlen(sub)))
+            return &str[i];
     }
 
-    free(*arg);
-    *arg = res; // move ownership
+    return NULL;
 }
 
 /*
-    Remove single and double quotes from a token
-    Every character must stay intact if it is within single quotes
-    Environment variables within double quotes must be replaced
-    with its value.
+    NAME=value in front of the command name. A '=' anywhere else
+    (set -o trace=FILE, dd if=...) is a normal argument.
 */
 
-static void
-strip_quote(char **s) // manipulate *s (string)
+static int
+is_assignment(char *str)
 {
-    dystring ds;
-    init_dystring(&ds);
-    char *str = *s; // borrow
-    
-    for(int i = 0; str[i]; i++)
-    {
-        if(str[i] == '\'')
-        {
-            i++;
-            while(str[i] && str[i] != '\'')
-                append_dystring(&ds, str[i++]);
-            continue;
-        }
-
-        if(str[i] == '\"')
-        {
-            i++;
-            dystring dquote;
-            init_dystring(&dquote);
-
-            while(str[i] && str[i] != '\"')
-                append_dystring(&dquote, str[i++]);
-           
-            expand_env(&dquote.string); // substitue environment variables
+    int i;
 
-            merge_dystring(&ds, dquote.string); // duplication
-            free(dquote.string);
-            continue;
-        }
+    if(!isalpha(str[0]) && str[0] != '_')
+        return 0;
 
-        append_dystring(&ds, str[i]);
-    }
+    for(i = 1; isalnum(str[i]) || str[i] == '_'; i++){}
 
-    free(*s);
-    *s = ds.string;
+    return str[i] == '=';
 }
 
-static char *
-find_unquoted(char *str, char c)
-{
-    Scanner scanner = {0, 0, 0};
-    int i;
-
-    for(i = 0; str[i] ; i++)
-    {
-        if(update_and_check_protected(&scanner, str[i]))
-            continue;
-        
-        if(str[i] == c)
-            return &str[i];
-    }
+/*
+    Words are expanded back into the token array: fields are written at
+    p_idx while tokens are read at next. A word that splits into more
+    fields than there is room for shifts the unread tokens right.
+*/
 
-    return NULL;
-}
+typedef struct
+{
+    char **argv;
+    int num_args;
+    int max_args;
+    int p_idx;
+    int next; // first unread token
+} FieldSink;
 
-static char *
-find_unquoted_sub(char *str, char *sub)
+static void
+sink_field(void *ctx, char *field)
 {
-    Scanner scanner = {0, 0, 0};
-    int i;
+    FieldSink *sink = ctx;
 
-    for(i = 0; str[i]; i++)
+    if(sink->p_idx == sink->next)
     {
-        if(update_and_check_protected(&scanner, str[i]))
-            continue;
-        
-        if(!strncmp(&str[i], sub, strlen(sub)))
-            return &str[i];
+        if(sink->num_args + 2 > sink->max_args)
+        {
+            sink->max_args *= 2;
+            sink->argv = realloc(sink->argv, sizeof(char *) * sink->max_args);
+            STAT_INC(allocs);
+            STAT_ADD(alloc_bytes, sizeof(char *) * sink->max_args);
+        }
+
+        memmove(&sink->argv[sink->next + 1], &sink->argv[sink->next],
+                sizeof(char *) * (sink->num_args - sink->next + 1));
+        sink->next++;
+        sink->num_args++;
     }
 
-    return NULL;
+    sink->argv[sink->p_idx++] = field; // ownership moved
 }
 
 static void
 parse_process(process *p, char *cmd)
 {
-    char **argv = tokenize_process(cmd);
-    int p_idx = 0;
+    FieldSink sink = {0};
     redirection **last = &p->redirs;
-    dyarray *envp = new_dyarray();
+    dyarray *envp = NULL; // only allocated for NAME=value words
+    uint64_t start = TRACE_START();
+
+    sink.argv = tokenize_process(cmd, &sink.num_args, &sink.max_args);
+
+    while(sink.next < sink.num_args)
+    {
+        char *word = sink.argv[sink.next++];
 
-    for(int i=0; argv[i] != NULL; i++)
-    {   
         // subshell: do not substitue stuff within subshells!!!
         // commands like ( echo " ; " ) will break otherwise
-        if (argv[i][0] == '(') {
-            p->argv[p_idx++] = argv[i];
+        if (word[0] == '(') {
+            sink.argv[sink.p_idx++] = word;
             continue;
         }
         
-        if(find_unquoted(argv[i], '=')) // environment variable declaration
+        if(sink.p_idx == 0 && is_assignment(word)) // environment variable declaration
         {
-            strip_quote(&argv[i]);
-            append_dyarray(envp, argv[i]);
-            free(argv[i]);
+            char *assignment = expand_string(word);
+            if(!envp)
+                envp = new_dyarray();
+            append_dyarray(envp, assignment);
+            free(assignment);
+            free(word);
             continue;
         }
 
-        if(is_redirec(argv[i]))
+        if(is_redirec(word))
         {
-            strip_quote(&argv[i]);
-            strip_quote(&argv[i + 1]);
-            *last = parse_redirec(argv[i], argv[i + 1]); // move ownership of r
+            if(sink.next == sink.num_args)
+            {
+                fprintf(stderr, "syntax error: missing filename after %s\n", word);
+                free(word);
+                break;
+            }
+
+            char *filename = sink.argv[sink.next++];
+            *last = parse_redirec(word, expand_string(filename)); // move ownership of r
             last = &(*last)->next;
-            i++; // skip filename 
+            free(filename);
+            continue;
+        }
+
+        if(!strpbrk(word, "$'\"")) // nothing to expand
+        {
+            sink.argv[sink.p_idx++] = word; // ownership moved
             continue;
         }
-        
-        expand_env(&argv[i]);
 
-        strip_quote(&argv[i]);
-        p->argv[p_idx++] = argv[i]; // ownership moved
+        expand_word(word, sink_field, &sink);
+        free(word);
     }
 
-    p->argv[p_idx] = NULL;
-    p->envp = envp->str; // envp.str ownership is moved to p->envp
-    free(envp); 
-    free(argv);
+    sink.argv[sink.p_idx] = NULL;
+    p->argv = sink.argv;
+    TRACE_END("expand", start, "words", sink.p_idx);
+
+    if(envp)
+    {
+        p->envp = envp->str; // envp.str ownership is moved to p->envp
+        free(envp); 
+    }
 }
 
 void
@@ -571,36 +582,133 @@ add_process(job *j, char *cmd)
 }
 
 
+/*
+    Keywords in front of a pipeline that change how the whole job is run:
+    time, @cpus=LIST, @node=N, limit name=value... and timeout DURATION
+    [--signal SIG], in any order. Returns a pointer past them.
+*/
+
+static char *
+parse_job_keywords(job *j, char *str)
+{
+    for(;;)
+    {
+        while(isspace(*str))
+            str++;
+
+        size_t len = strcspn(str, " \t\n");
+
+        if(len == 4 && !strncmp(str, "time", 4))
+            j->timed = 1;
+        else if(len > 6 && !strncmp(str, "@cpus=", 6))
+        {
+            free(j->cpus);
+            j->cpus = strndup(str + 6, len - 6);
+        }
+        else if(len > 6 && !strncmp(str, "@node=", 6) && strspn(str + 6, "0123456789") == len - 6)
+            j->node = atoi(str + 6);
+        else if(len == 5 && !strncmp(str, "limit", 5))
+        {
+            // lowercase name=value words, NAME=value is still an assignment
+            for(str += len; ; str += len)
+            {
+                while(isspace(*str))
+                    str++;
+                len = strcspn(str, " \t\n");
+                size_t name = strspn(str, "abcdefghijklmnopqrstuvwxyz");
+                if(name == 0 || str[name] != '=')
+                    break;
+
+                size_t old = j->limits ? strlen(j->limits) : 0;
+                j->limits = realloc(j->limits, old + len + 2);
+                if(old)
+                    j->limits[old++] = ' ';
+                memcpy(j->limits + old, str, len);
+                j->limits[old + len] = '\0';
+            }
+            continue;
+        }
+        else if(len == 7 && !strncmp(str, "timeout", 7))
+        {
+            // without a DURATION it is not ours, the timeout command runs
+            char *word = str + len, *duration = NULL, *sig = NULL;
+            size_t duration_len = 0, sig_len = 0;
+
+            for(;;)
+            {
+                while(isspace(*word))
+                    word++;
+                size_t wlen = strcspn(word, " \t\n");
+
+                if(!duration && isdigit(*word))
+                {
+                    duration = word;
+                    duration_len = wlen;
+                }
+                else if(!sig && ((wlen == 8 && !strncmp(word, "--signal", 8)) ||
+                                 (wlen == 2 && !strncmp(word, "-s", 2))))
+                {
+                    word += wlen;
+                    while(isspace(*word))
+                        word++;
+                    sig = word;
+                    sig_len = wlen = strcspn(word, " \t\n");
+                }
+                else
+                    break;
+                word += wlen;
+            }
+            if(!duration)
+                return str;
+
+            free(j->timeout);
+            j->timeout = malloc(duration_len + sig_len + 2);
+            snprintf(j->timeout, duration_len + sig_len + 2, "%.*s%s%.*s", (int)duration_len, duration,
+                     sig ? " " : "", (int)sig_len, sig ? sig : "");
+            str = word;
+            continue;
+        }
+        else
+            return str;
+
+        str += len;
+    }
+}
+
 job *
 parse_job(char *str)
 {
+    uint64_t start = stats_now();
     job *j = new_job();
     j->command = strdup(str);
+    STAT_INC(allocs);
+    STAT_ADD(alloc_bytes, strlen(str) + 1);
+    str = parse_job_keywords(j, str);
     dystring ds;
     init_dystring(&ds);
-    Scanner scanner = {0, 0, 0};
+    Scanner scanner = {0, 0, 0, 0, 0};
+    int seg = 0;
+    int i;
 
-    for(int i=0; str[i]; i++){
+    for(i = next_special(&scanner, str, 0, 0); str[i]; i = next_special(&scanner, str, i + 1, 0)){
         if(update_and_check_protected(&scanner, str[i]))
-        {
-            append_dystring(&ds, str[i]);
             continue;
-        }
         
         if(str[i] == '|'){
-            add_process(j, ds.string);
-            free(ds.string);
-            init_dystring(&ds);
-            continue;
+            append_dystring_n(&ds, &str[seg], i - seg);
+            add_process(j, ds.string); // borrow
+            free_dystring(&ds);
+            seg = i + 1;
         }
-        
-        append_dystring(&ds, str[i]);
     }
 
-    if(ds.curr_size > 0){
+    if(i > seg)
+    {
+        append_dystring_n(&ds, &str[seg], i - seg);
         add_process(j, ds.string);
-        free(ds.string);
     }
+    free_dystring(&ds);
 
+    stats_record(&shell_stats->parse, stats_now() - start);
     return j;
 }
\ No newline at end of file
@@ -0,0 +1,403 @@
+#define _GNU_SOURCE
+#include "pathindex.h"
+#include "my_shell.h"
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+/*
+ *  The trie lives in one array of nodes linked by index: first child and
+ *  next sibling, siblings in byte order. Building it is a readdir of
+ *  every PATH directory, freeing it is two frees. A rebuilt index is
+ *  swapped in under index_lock, lookups hold the lock while they walk.
+ */
+
+typedef struct TrieNode
+{
+    int child;       // first child, -1 if none
+    int sibling;     // next child of the same parent, -1 if none
+    int dir;         // PATH entry holding the executable ending here, -1 if none
+    unsigned char c;
+} TrieNode;
+
+typedef struct PathIndex
+{
+    TrieNode *nodes; // nodes[0] is the root
+    int num_nodes;
+    int max_nodes;
+    char **dirs;
+    int num_dirs;
+} PathIndex;
+
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                      IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+#define DEBOUNCE_MS 100
+
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+static PathIndex *current;        // NULL until built, guarded by index_lock
+static char *pending_path;        // new PATH for the thread, guarded by index_lock
+static int wake_pipe[2] = {-1, -1};
+static int watch_fd = -1;         // made on the main thread, see pathindex_start
+
+static int
+new_node(PathIndex *idx, unsigned char c)
+{
+    TrieNode *n = &idx->nodes[idx->num_nodes];
+
+    n->child = -1;
+    n->sibling = -1;
+    n->dir = -1;
+    n->c = c;
+    return idx->num_nodes++;
+}
+
+static void
+trie_insert(PathIndex *idx, const char *name, int dir)
+{
+    size_t len = strlen(name);
+    int n = 0;
+
+    // grow first, the links below point into the array
+    if(idx->num_nodes + (int)len > idx->max_nodes)
+    {
+        while(idx->num_nodes + (int)len > idx->max_nodes)
+            idx->max_nodes *= 2;
+        idx->nodes = realloc(idx->nodes, sizeof(TrieNode) * idx->max_nodes);
+    }
+
+    for(const unsigned char *s = (const unsigned char *)name; *s; s++)
+    {
+        int *link = &idx->nodes[n].child;
+
+        while(*link >= 0 && idx->nodes[*link].c < *s)
+            link = &idx->nodes[*link].sibling;
+
+        if(*link < 0 || idx->nodes[*link].c != *s)
+        {
+            int m = new_node(idx, *s);
+            idx->nodes[m].sibling = *link;
+            *link = m;
+        }
+
+        n = *link;
+    }
+
+    if(idx->nodes[n].dir < 0) // the first PATH entry wins, as in execvp
+        idx->nodes[n].dir = dir;
+}
+
+static int
+trie_find(PathIndex *idx, const char *prefix)
+{
+    int n = 0;
+
+    for(const unsigned char *s = (const unsigned char *)prefix; *s; s++)
+    {
+        n = idx->nodes[n].child;
+        while(n >= 0 && idx->nodes[n].c != *s)
+            n = idx->nodes[n].sibling;
+        if(n < 0)
+            return -1;
+    }
+
+    return n;
+}
+
+static void
+collect(PathIndex *idx, int n, dystring *word, dyarray *out)
+{
+    if(idx->nodes[n].dir >= 0)
+        append_dyarray(out, word->string);
+
+    for(int c = idx->nodes[n].child; c >= 0; c = idx->nodes[c].sibling)
+    {
+        append_dystring(word, idx->nodes[c].c);
+        collect(idx, c, word, out);
+        word->string[--word->curr_size] = '\0';
+    }
+}
+
+static void
+free_index(PathIndex *idx)
+{
+    if(idx == NULL)
+        return;
+
+    for(int i = 0; i < idx->num_dirs; i++)
+        free(idx->dirs[i]);
+    free(idx->dirs);
+    free(idx->nodes);
+    free(idx);
+}
+
+/*
+ *  Empty index over the directories of path, an empty entry being the cwd
+ */
+
+static PathIndex *
+new_index(const char *path)
+{
+    PathIndex *idx = calloc(1, sizeof(PathIndex));
+    const char *p = path;
+
+    idx->max_nodes = 1024;
+    idx->nodes = malloc(sizeof(TrieNode) * idx->max_nodes);
+    new_node(idx, 0);
+
+    for(;;)
+    {
+        const char *end = strchrnul(p, ':');
+        int d = idx->num_dirs++;
+
+        idx->dirs = realloc(idx->dirs, sizeof(char *) * idx->num_dirs);
+        idx->dirs[d] = end == p ? strdup(".") : strndup(p, end - p);
+
+        if(!*end)
+            break;
+        p = end + 1;
+    }
+
+    return idx;
+}
+
+static void
+scan_index(PathIndex *idx)
+{
+    for(int d = 0; d < idx->num_dirs; d++)
+    {
+        DIR *dp = opendir(idx->dirs[d]);
+        struct dirent *de;
+        struct stat st;
+
+        if(dp == NULL)
+            continue;
+
+        while((de = readdir(dp)))
+        {
+            if(de->d_name[0] == '.' && (!de->d_name[1] || (de->d_name[1] == '.' && !de->d_name[2])))
+                continue;
+            if(de->d_type == DT_DIR)
+                continue;
+            if(fstatat(dirfd(dp), de->d_name, &st, 0) == 0 &&
+               S_ISREG(st.st_mode) && (st.st_mode & 0111))
+                trie_insert(idx, de->d_name, d);
+        }
+        closedir(dp);
+    }
+}
+
+static void
+swap_index(PathIndex *idx)
+{
+    pthread_mutex_lock(&index_lock);
+    PathIndex *old = current;
+    current = idx;
+    pthread_mutex_unlock(&index_lock);
+
+    free_index(old);
+}
+
+static void
+drain(int fd)
+{
+    char buf[4096];
+
+    while(read(fd, buf, sizeof(buf)) > 0){}
+}
+
+/*
+ *  Watch first, then scan, so nothing created during the scan is missed.
+ *  A burst of events (a package install) is one rebuild: wait until the
+ *  directories have been quiet for DEBOUNCE_MS.
+ *
+ *  The one inotify fd is kept for the life of the thread: watching a
+ *  directory again returns its old wd, and the wds of directories no
+ *  longer in PATH are removed.
+ */
+
+static void *
+index_thread(void *arg)
+{
+    char *path = arg;
+    int ifd = watch_fd;
+    int *wds = NULL, num_wds = 0;
+
+    for(;;)
+    {
+        PathIndex *idx = new_index(path);
+        int *new_wds = malloc(sizeof(int) * (idx->num_dirs + 1));
+        int num_new = 0;
+
+        for(int i = 0; ifd >= 0 && i < idx->num_dirs; i++)
+        {
+            int wd = inotify_add_watch(ifd, idx->dirs[i], WATCH_EVENTS);
+            if(wd >= 0)
+                new_wds[num_new++] = wd;
+        }
+        for(int i = 0; i < num_wds; i++)
+        {
+            int kept = 0;
+            for(int k = 0; k < num_new && !kept; k++)
+                kept = new_wds[k] == wds[i];
+            if(!kept)
+                inotify_rm_watch(ifd, wds[i]);
+        }
+        free(wds);
+        wds = new_wds;
+        num_wds = num_new;
+
+        scan_index(idx);
+        swap_index(idx);
+
+        struct pollfd fds[2] = {{wake_pipe[0], POLLIN, 0}, {ifd, POLLIN, 0}};
+        while(poll(fds, ifd >= 0 ? 2 : 1, -1) < 0){}
+
+        if(fds[0].revents & POLLIN)
+        {
+            drain(wake_pipe[0]);
+            pthread_mutex_lock(&index_lock);
+            if(pending_path)
+            {
+                free(path);
+                path = pending_path;
+                pending_path = NULL;
+            }
+            pthread_mutex_unlock(&index_lock);
+            continue;
+        }
+
+        do
+            drain(ifd);
+        while(poll(&fds[1], 1, DEBOUNCE_MS) > 0);
+    }
+
+    return NULL;
+}
+
+static void
+lock_index()
+{
+    pthread_mutex_lock(&index_lock);
+}
+
+static void
+unlock_index()
+{
+    pthread_mutex_unlock(&index_lock);
+}
+
+void
+pathindex_start(const char *path)
+{
+    pthread_t tid;
+    sigset_t all, prev;
+
+    if(pipe2(wake_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+    {
+        perror("pathindex pipe");
+        return;
+    }
+    wake_pipe[0] = shell_fd(wake_pipe[0]);
+    wake_pipe[1] = shell_fd(wake_pipe[1]);
+
+    // shell_fd closes the low fd it moves, only safe where exec and
+    // builtin redirections run: not on the thread
+    watch_fd = shell_fd(inotify_init1(IN_CLOEXEC | IN_NONBLOCK));
+
+    // a fork while the thread holds the lock must not copy it locked
+    pthread_atfork(lock_index, unlock_index, unlock_index);
+
+    // signals (SIGCHLD above all) stay with the main thread
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &prev);
+    if(pthread_create(&tid, NULL, index_thread, strdup(path ? path : "")) == 0)
+        pthread_detach(tid);
+    else
+        perror("pathindex thread");
+    pthread_sigmask(SIG_SETMASK, &prev, NULL);
+}
+
+/*
+ *  Drop the index for the old PATH right away, lookups miss (and fall
+ *  back to execvp) until the thread has rebuilt it
+ */
+
+void
+pathindex_set_path(const char *path)
+{
+    if(wake_pipe[1] < 0)
+        return;
+
+    pthread_mutex_lock(&index_lock);
+    free(pending_path);
+    pending_path = strdup(path ? path : "");
+    PathIndex *old = current;
+    current = NULL;
+    pthread_mutex_unlock(&index_lock);
+
+    free_index(old);
+    if(write(wake_pipe[1], "", 1) < 0)
+        perror("pathindex wake");
+}
+
+/*
+ *  Full path of the executable, malloced, or NULL if it is not indexed
+ */
+
+char *
+pathindex_lookup(const char *name)
+{
+    char *res = NULL;
+
+    pthread_mutex_lock(&index_lock);
+    if(current)
+    {
+        int n = trie_find(current, name);
+
+        // relative PATH entries depend on the cwd at exec time, leave them to execvp
+        if(n > 0 && current->nodes[n].dir >= 0 && current->dirs[current->nodes[n].dir][0] == '/')
+        {
+            dystring ds;
+            init_dystring(&ds);
+            merge_dystring(&ds, current->dirs[current->nodes[n].dir]);
+            append_dystring(&ds, '/');
+            merge_dystring(&ds, name);
+            res = steal_dystring(&ds);
+        }
+    }
+    pthread_mutex_unlock(&index_lock);
+
+    return res;
+}
+
+/*
+ *  Every indexed name starting with prefix, in byte order
+ */
+
+void
+pathindex_complete(const char *prefix, dyarray *out)
+{
+    pthread_mutex_lock(&index_lock);
+    if(current)
+    {
+        int n = trie_find(current, prefix);
+
+        if(n >= 0)
+        {
+            dystring word;
+            init_dystring(&word);
+            merge_dystring(&word, prefix);
+            collect(current, n, &word, out);
+            free_dystring(&word);
+        }
+    }
+    pthread_mutex_unlock(&index_lock);
+}
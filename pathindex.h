@@ -0,0 +1,20 @@
+#ifndef PATHINDEX_H
+#define PATHINDEX_H
+
+#include "dynamicstring.h"
+
+/*
+ *  Index of every executable on PATH, as a prefix trie. Built on a
+ *  background thread and rebuilt when inotify reports a change in one
+ *  of the PATH directories or the shell's PATH changes.
+ *
+ *  Until the first build finishes, lookups miss and callers fall back
+ *  to searching PATH themselves.
+ */
+
+void pathindex_start(const char *path);
+void pathindex_set_path(const char *path);
+char *pathindex_lookup(const char *name);
+void pathindex_complete(const char *prefix, dyarray *out);
+
+#endif
@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include "pipes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#define CHUNK (1 << 30) // per sendfile/splice call, the kernel caps it anyway
+
+static int pipe_size; // 0: leave the kernel default
+
+int
+make_pipe(int fds[2])
+{
+    if(pipe2(fds, O_CLOEXEC) < 0)
+        return -1;
+
+    if(pipe_size)
+        fcntl(fds[1], F_SETPIPE_SZ, pipe_size); // checked once by set_pipesize
+
+    return 0;
+}
+
+/*
+ *  Unprivileged shells are capped by /proc/sys/fs/pipe-max-size, so the
+ *  size is tried on a scratch pipe here rather than failing every launch.
+ */
+
+int
+set_pipesize(char *value)
+{
+    int fds[2];
+    char *end;
+    long size;
+
+    if(!value)
+    {
+        pipe_size = 0;
+        return 0;
+    }
+
+    size = strtol(value, &end, 10);
+    if(*end == 'k' || *end == 'K')
+        size <<= 10, end++;
+    else if(*end == 'm' || *end == 'M')
+        size <<= 20, end++;
+
+    if(*end || size <= 0 || size > (1L << 30))
+    {
+        fprintf(stderr, "set: pipesize: %s: not a size\n", value);
+        return 1 << 8;
+    }
+
+    if(pipe2(fds, O_CLOEXEC) < 0)
+    {
+        perror("pipe");
+        return 1 << 8;
+    }
+
+    int got = fcntl(fds[1], F_SETPIPE_SZ, (int)size);
+    close(fds[0]);
+    close(fds[1]);
+    if(got < 0)
+    {
+        perror("set: pipesize");
+        return 1 << 8;
+    }
+
+    pipe_size = got; // rounded up to a power of two pages
+    return 0;
+}
+
+static int
+is_pipe(int fd)
+{
+    struct stat st;
+
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+static int
+copy_fd(int in, int out)
+{
+    char buf[65536];
+    ssize_t n;
+
+    while((n = read(in, buf, sizeof(buf))) != 0)
+    {
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        for(ssize_t off = 0, w; off < n; off += w)
+            if((w = write(out, buf + off, n - off)) < 0)
+            {
+                if(errno != EINTR)
+                    return -1;
+                w = 0;
+            }
+    }
+
+    return 0;
+}
+
+/*
+ *  splice needs a pipe on one side, sendfile an mmapable input. Whatever
+ *  neither takes (tty to tty, O_APPEND outputs for splice) is copied.
+ */
+
+static int
+move_fd(int in, int out)
+{
+    int spliceable = is_pipe(in) || is_pipe(out);
+    ssize_t n;
+
+    for(;;)
+    {
+        if(spliceable)
+            n = splice(in, NULL, out, NULL, CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        else
+            n = sendfile(out, in, NULL, CHUNK);
+
+        if(n > 0)
+            continue;
+        if(n == 0)
+            return 0;
+        if(errno == EINTR)
+            continue;
+        if(errno == EINVAL || errno == ENOSYS)
+            break;
+        return -1;
+    }
+
+    // splice refused: a file input still has sendfile
+    if(spliceable && !is_pipe(in))
+    {
+        while((n = sendfile(out, in, NULL, CHUNK)) > 0 || (n < 0 && errno == EINTR)){}
+        if(n == 0)
+            return 0;
+        if(errno != EINVAL && errno != ENOSYS)
+            return -1;
+    }
+
+    return copy_fd(in, out);
+}
+
+int
+pipe_cat(char **argv)
+{
+    static char *stdin_only[] = {"cat", "-", NULL};
+    int status = 0;
+
+    for(int i = 1; argv[i]; i++)
+        if(argv[i][0] == '-' && argv[i][1]) // -n, -A ...: exec the real cat
+            return -1;
+
+    if(!argv[1])
+        argv = stdin_only;
+
+    for(int i = 1; argv[i]; i++)
+    {
+        int fd = strcmp(argv[i], "-") ? open(argv[i], O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+
+        if(fd < 0)
+        {
+            fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+
+        if(move_fd(fd, STDOUT_FILENO) < 0)
+        {
+            fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(errno));
+            status = 1;
+        }
+
+        if(fd != STDIN_FILENO)
+            close(fd);
+    }
+
+    return status;
+}
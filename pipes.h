@@ -0,0 +1,22 @@
+#ifndef PIPES_H
+#define PIPES_H
+
+/*
+ *  Pipeline plumbing. Links are made close-on-exec, so a stage only keeps
+ *  the ends dup2'ed onto its stdin and stdout, and sized by
+ *  set -o pipesize=N (K and M suffixes, kernel default when unset).
+ */
+
+int make_pipe(int fds[2]);
+int set_pipesize(char *value);
+
+/*
+ *  cat [FILE...] run in the forked child instead of exec'ing cat. Data
+ *  moves with sendfile and splice and never through user space, unless
+ *  neither end allows it. Returns the exit status, or -1 without doing
+ *  anything when there are options, which are left to the real cat.
+ */
+
+int pipe_cat(char **argv);
+
+#endif
@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include "pipestat.h"
+#include "pipes.h"
+#include "stats.h"
+#include "outbuf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#define CHUNK (1 << 20)
+
+typedef struct LinkStat
+{
+    uint64_t bytes;
+    uint64_t full_ns;  // waiting for the next stage to drain
+    uint64_t empty_ns; // waiting for the previous stage to write
+    uint64_t start_ns;
+    uint64_t end_ns;   // 0 while the relay runs
+} LinkStat;
+
+struct pipestat
+{
+    size_t size; // of the mapping
+    int links;
+    LinkStat link[];
+};
+
+static int pipestat_enabled;
+
+int
+set_pipestat(char *value)
+{
+    if(value && value[0])
+    {
+        fprintf(stderr, "set: pipestat takes no value\n");
+        return 1 << 8;
+    }
+
+    pipestat_enabled = value != NULL;
+    return 0;
+}
+
+void
+pipestat_attach(job *j)
+{
+    int links = 0;
+
+    if(!pipestat_enabled)
+        return;
+
+    for(process *p = j->first_process; p && p->next; p = p->next)
+        links++;
+    if(links == 0)
+        return;
+
+    size_t size = sizeof(struct pipestat) + links * sizeof(LinkStat);
+    struct pipestat *ps = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(ps == MAP_FAILED)
+    {
+        perror("mmap (pipestat)");
+        return;
+    }
+
+    ps->size = size;
+    ps->links = links;
+    j->pipestat = ps;
+}
+
+/*
+ *  Splice without blocking. When nothing moves, FIONREAD on the input
+ *  tells which side is holding things up, and the wait is charged to it.
+ */
+
+static void
+relay_main(LinkStat *ls, int in, int out)
+{
+    ls->start_ns = stats_now();
+
+    for(;;)
+    {
+        ssize_t n = splice(in, NULL, out, NULL, CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        if(n > 0)
+        {
+            __atomic_fetch_add(&ls->bytes, n, __ATOMIC_RELAXED);
+            continue;
+        }
+        if(n == 0)
+            break;
+        if(errno == EINTR)
+            continue;
+        if(errno != EAGAIN)
+            break;
+
+        int avail = 0;
+        ioctl(in, FIONREAD, &avail);
+
+        struct pollfd pfd = {avail ? out : in, avail ? POLLOUT : POLLIN, 0};
+        uint64_t wait = stats_now();
+
+        while(poll(&pfd, 1, -1) < 0 && errno == EINTR){}
+        __atomic_fetch_add(avail ? &ls->full_ns : &ls->empty_ns, stats_now() - wait,
+                           __ATOMIC_RELAXED);
+    }
+
+    ls->end_ns = stats_now();
+    _exit(0);
+}
+
+/*
+ *  Put a relay after in, the read end of a link. Returns the read end the
+ *  next stage takes instead, or in itself when no relay could be started.
+ */
+
+int
+pipestat_relay(job *j, int link, int in)
+{
+    int out[2];
+    pid_t pid;
+
+    if(!j->pipestat || make_pipe(out) < 0)
+        return in;
+
+    pid = fork_relay(j);
+    if(pid == 0)
+    {
+        close(out[0]);
+        relay_main(&j->pipestat->link[link], in, out[1]);
+    }
+    close(out[1]);
+    if(pid < 0)
+    {
+        close(out[0]);
+        return in;
+    }
+
+    close(in);
+    return out[0];
+}
+
+static double
+percent(uint64_t part, uint64_t whole)
+{
+    return whole ? 100.0 * part / whole : 0;
+}
+
+/*
+ *  One line per link, then the stage that looks like the bottleneck.
+ *  A slow stage backs up every link in front of it and starves every
+ *  link behind it, so it sits after the last link that was mostly full,
+ *  or is the first stage when none was.
+ */
+
+void
+pipestat_report(job *j)
+{
+    struct pipestat *ps = j->pipestat;
+    process *p = j->first_process;
+    process *slowest = p;
+    uint64_t waited = 0;
+    uint64_t now = stats_now();
+
+    if(!ps)
+        return;
+
+    outbuf_printf(STDERR_FILENO, "%-24s %12s %9s %6s %6s\n", "link", "bytes", "MB/s", "full", "empty");
+
+    for(int i = 0; i < ps->links && p && p->next; i++, p = p->next)
+    {
+        LinkStat *ls = &ps->link[i];
+        uint64_t end = ls->end_ns ? ls->end_ns : now;
+        uint64_t span = ls->start_ns && end > ls->start_ns ? end - ls->start_ns : 0;
+        char name[64];
+
+        snprintf(name, sizeof(name), "%s | %s", p->argv[0], p->next->argv[0]);
+        outbuf_printf(STDERR_FILENO, "%-24s %12llu %9.2f %5.0f%% %5.0f%%\n", name,
+                      (unsigned long long)ls->bytes, span ? ls->bytes / 1e6 / (span / 1e9) : 0,
+                      percent(ls->full_ns, span), percent(ls->empty_ns, span));
+
+        if(ls->full_ns > ls->empty_ns)
+            slowest = p->next;
+        waited += ls->full_ns + ls->empty_ns;
+    }
+
+    if(waited)
+        outbuf_printf(STDERR_FILENO, "bottleneck: %s\n", slowest->argv[0]);
+}
+
+void
+pipestat_free(job *j)
+{
+    if(j->pipestat)
+        munmap(j->pipestat, j->pipestat->size);
+    j->pipestat = NULL;
+}
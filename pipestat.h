@@ -0,0 +1,24 @@
+#ifndef PIPESTAT_H
+#define PIPESTAT_H
+
+#include "jobcontrol.h"
+
+/*
+ *  set -o pipestat: every link of a pipeline goes through a relay, a
+ *  forked copy of the shell in the job's process group that splices from
+ *  one stage to the next. It counts the bytes moved, the time spent with
+ *  the downstream pipe full (the next stage is slower) and the time spent
+ *  with the upstream pipe empty (the previous stage is slower).
+ *
+ *  Counters live in a shared mapping, so the shell reads them live for
+ *  jobs -v and reports them once the job completes.
+ */
+
+int set_pipestat(char *value);
+
+void pipestat_attach(job *j);
+int pipestat_relay(job *j, int link, int in);
+void pipestat_report(job *j);
+void pipestat_free(job *j);
+
+#endif
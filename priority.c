@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include "priority.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_NONE  0
+#define IOPRIO_CLASS_IDLE  3
+
+static int bg_nice; // 0: background jobs run like foreground ones
+
+// set for the children of a job launched with &, worked out before fork
+static int pending_lower;
+static int pending_base;
+
+int
+set_bgnice(char *value)
+{
+    char *end;
+    long n;
+
+    if(value == NULL)
+    {
+        bg_nice = 0;
+        return 0;
+    }
+
+    n = strtol(value, &end, 10);
+    if(!value[0] || *end || n < 1 || n > 19)
+    {
+        fprintf(stderr, "set: bgnice: %s: not between 1 and 19\n", value);
+        return 1 << 8;
+    }
+
+    bg_nice = n;
+    return 0;
+}
+
+/*
+ *  Each process as a whole: nice and the I/O class apply to the pid,
+ *  threads it already started keep theirs.
+ */
+
+static void
+lower(pid_t pid, int base)
+{
+    struct sched_param sp = {0};
+    int prio = base + bg_nice > 19 ? 19 : base + bg_nice;
+
+    setpriority(PRIO_PROCESS, pid, prio);
+    sched_setscheduler(pid, SCHED_BATCH, &sp);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+}
+
+/*
+ *  Raising nice back needs CAP_SYS_NICE or RLIMIT_NICE, the scheduler
+ *  and I/O class do not. Returns -1 when nice stayed lowered.
+ */
+
+static int
+restore(pid_t pid, int base)
+{
+    struct sched_param sp = {0};
+    int res = 0;
+
+    sched_setscheduler(pid, SCHED_OTHER, &sp);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, IOPRIO_CLASS_NONE << IOPRIO_CLASS_SHIFT);
+    if(setpriority(PRIO_PROCESS, pid, base) < 0 && errno == EPERM)
+        res = -1;
+
+    return res;
+}
+
+/*
+ *  A job launched with & is lowered by each child before exec, so what it
+ *  starts right away (make's compilers) inherits the lowered priority.
+ *  The pass over running pids below is left for bg.
+ */
+
+void
+priority_begin(job *j, int foreground)
+{
+    pending_lower = 0;
+    if(!bg_nice || foreground)
+        return;
+
+    errno = 0;
+    pending_base = getpriority(PRIO_PROCESS, 0);
+    if(errno)
+        return;
+
+    pending_lower = 1;
+    j->lowered = 1;
+}
+
+// in the child
+void
+priority_apply()
+{
+    if(pending_lower)
+        lower(0, pending_base);
+}
+
+// once the job's processes and relays are forked, so a builtin's relay is not lowered
+void
+priority_end()
+{
+    pending_lower = 0;
+}
+
+void
+priority_background(job *j)
+{
+    int base;
+
+    if(!bg_nice || j->lowered)
+        return;
+
+    errno = 0;
+    base = getpriority(PRIO_PROCESS, 0);
+    if(errno)
+        return;
+
+    for(process *p = j->first_process; p; p = p->next)
+        if(!p->completed && p->pid > 0)
+            lower(p->pid, base);
+    for(process *p = j->relays; p; p = p->next)
+        if(!p->completed)
+            lower(p->pid, base);
+
+    j->lowered = 1;
+}
+
+void
+priority_foreground(job *j)
+{
+    int base, failed = 0;
+
+    if(!j->lowered)
+        return;
+
+    errno = 0;
+    base = getpriority(PRIO_PROCESS, 0);
+    if(errno)
+        return;
+
+    for(process *p = j->first_process; p; p = p->next)
+        if(!p->completed && p->pid > 0)
+            failed |= restore(p->pid, base) < 0;
+    for(process *p = j->relays; p; p = p->next)
+        if(!p->completed)
+            failed |= restore(p->pid, base) < 0;
+
+    if(failed)
+        fprintf(stderr, "%ld: nice stays at +%d, raising it back needs CAP_SYS_NICE\n",
+                (long)j->pgid, bg_nice);
+    j->lowered = 0;
+}
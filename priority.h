@@ -0,0 +1,25 @@
+#ifndef PRIORITY_H
+#define PRIORITY_H
+
+#include "jobcontrol.h"
+
+/*
+ *  set -o bgnice=N: jobs put in the background (& or bg) are reniced by
+ *  N, moved to SCHED_BATCH and given the idle I/O class, so a build
+ *  left running behind the prompt does not slow down the foreground.
+ *  fg puts them back to the shell's own priority.
+ *
+ *  With & every child lowers itself before exec (priority_begin, then
+ *  priority_apply in the child, priority_end once all are forked). bg
+ *  lowers the running pids from the shell.
+ */
+
+int set_bgnice(char *value);
+
+void priority_begin(job *j, int foreground);
+void priority_apply();
+void priority_end();
+void priority_background(job *j);
+void priority_foreground(job *j);
+
+#endif
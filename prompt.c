@@ -0,0 +1,367 @@
+#define _GNU_SOURCE
+#include "prompt.h"
+#include "my_shell.h"
+#include "jobcontrol.h"
+#include "dynamicstring.h"
+#include "outbuf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+ *  The helper is a child forked once and kept for the life of the shell.
+ *  It runs git itself, so the shell's SIGCHLD handler never sees those
+ *  processes. Requests are one cwd per line, answers one
+ *  "cwd TAB git TAB load" per line.
+ */
+
+static pid_t helper_pid = -1;
+static int request_pipe[2] = {-1, -1}; // shell -> helper
+static int result_pipe[2] = {-1, -1};  // helper -> shell
+
+static char *cached_cwd; // directory the cached git segment belongs to
+static char *cached_git;
+static char *cached_load;
+static dystring result;  // answer bytes not yet ending in a newline
+static dystring prompt;
+
+/*
+ *  ## main...origin/main [ahead 1]
+ *   M parser.c
+ *
+ *  gives "main*". Nothing outside a work tree.
+ */
+
+static void
+git_segment(dystring *out)
+{
+    int fds[2];
+    char buf[4096];
+    ssize_t n;
+    dystring ds;
+    pid_t pid;
+
+    if(pipe(fds) < 0)
+        return;
+
+    pid = fork();
+    if(pid == 0)
+    {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execlp("git", "git", "--no-optional-locks", "status", "--porcelain", "-b", "-uno", (char *)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    if(pid < 0)
+    {
+        close(fds[0]);
+        return;
+    }
+
+    init_dystring(&ds);
+    while((n = read(fds[0], buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))
+        if(n > 0)
+            append_dystring_n(&ds, buf, n);
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+
+    if(!strncmp(ds.string, "## ", 3))
+    {
+        char *branch = ds.string + 3;
+        char *nl = strchr(branch, '\n');
+        char *end;
+
+        if(nl)
+            *nl = '\0';
+        if(!strncmp(branch, "No commits yet on ", 18))
+            branch += 18;
+        if((end = strstr(branch, "...")) || (end = strchr(branch, ' ')))
+            *end = '\0';
+
+        merge_dystring(out, branch);
+        if(nl && nl[1])
+            append_dystring(out, '*');
+    }
+
+    free_dystring(&ds);
+}
+
+/*
+ *  Answer the newest request only, older ones are for prompts that have
+ *  already been replaced.
+ */
+
+static void
+helper_main()
+{
+    dystring req, ans;
+    char buf[4096];
+    ssize_t n;
+    sigset_t none;
+
+    signal(SIGCHLD, SIG_DFL);
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    close(request_pipe[1]);
+    close(result_pipe[0]);
+    init_dystring(&req);
+    init_dystring(&ans);
+
+    while((n = read(request_pipe[0], buf, sizeof(buf))) != 0)
+    {
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        append_dystring_n(&req, buf, n);
+
+        char *last = NULL, *p = req.string;
+        char *nl;
+        while((nl = strchr(p, '\n')))
+        {
+            *nl = '\0';
+            last = p;
+            p = nl + 1;
+        }
+        if(last == NULL)
+            continue;
+
+        double load[1];
+        char num[32] = "";
+
+        if(getloadavg(load, 1) == 1)
+            snprintf(num, sizeof(num), "%.2f", load[0]);
+
+        merge_dystring(&ans, last);
+        append_dystring(&ans, '\t');
+        if(chdir(last) == 0)
+            git_segment(&ans);
+        append_dystring(&ans, '\t');
+        merge_dystring(&ans, num);
+        append_dystring(&ans, '\n');
+        if(write(result_pipe[1], ans.string, ans.curr_size) < 0)
+            break;
+        free_dystring(&ans);
+
+        // keep a partial request for the next read
+        char *rest = strdup(p);
+        free_dystring(&req);
+        merge_dystring(&req, rest);
+        free(rest);
+    }
+
+    _exit(0);
+}
+
+static void
+start_helper()
+{
+    sigset_t prev;
+
+    outbuf_flush_all();
+    // SIGCHLD waits until helper_pid is known
+    sigprocmask(SIG_BLOCK, &mask_chld, &prev);
+    helper_pid = fork();
+    if(helper_pid == 0)
+        helper_main();
+    if(helper_pid < 0)
+        perror("prompt helper");
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+/*
+ *  Called from the SIGCHLD handler: the helper is not a job. It is
+ *  started again on the next prompt that needs it.
+ */
+
+int
+prompt_helper(pid_t pid)
+{
+    if(pid != helper_pid)
+        return 0;
+
+    helper_pid = -1;
+    return 1;
+}
+
+int
+prompt_init()
+{
+    if(pipe2(request_pipe, O_CLOEXEC) < 0 || pipe2(result_pipe, O_CLOEXEC) < 0)
+    {
+        perror("prompt pipe");
+        return -1;
+    }
+
+    for(int i = 0; i < 2; i++)
+    {
+        request_pipe[i] = shell_fd(request_pipe[i]);
+        result_pipe[i] = shell_fd(result_pipe[i]);
+    }
+
+    fcntl(request_pipe[1], F_SETFL, O_NONBLOCK); // a busy helper never blocks the shell
+    fcntl(result_pipe[0], F_SETFL, O_NONBLOCK);
+    init_dystring(&result);
+    init_dystring(&prompt);
+
+    return result_pipe[0];
+}
+
+static void
+append_duration(dystring *ds, double sec)
+{
+    char buf[32];
+
+    if(sec < 1)
+        snprintf(buf, sizeof(buf), "%dms", (int)(sec * 1000));
+    else if(sec < 60)
+        snprintf(buf, sizeof(buf), "%.1fs", sec);
+    else
+        snprintf(buf, sizeof(buf), "%dm%02ds", (int)sec / 60, (int)sec % 60);
+
+    merge_dystring(ds, buf);
+}
+
+static const char *
+render()
+{
+    const char *fmt = find_environ("PROMPT", 6);
+    const char *home = find_environ("HOME", 4);
+    char cwd[4096];
+    char num[16];
+
+    if(fmt == NULL)
+        fmt = "< ";
+    if(getcwd(cwd, sizeof(cwd)) == NULL)
+        cwd[0] = '\0';
+
+    free_dystring(&prompt);
+
+    for(const char *f = fmt; *f; f++)
+    {
+        if(*f != '%' || !f[1])
+        {
+            append_dystring(&prompt, *f);
+            continue;
+        }
+
+        switch(*++f)
+        {
+            case 'd':
+            {
+                size_t len = home ? strlen(home) : 0;
+                if(len && !strncmp(cwd, home, len) && (cwd[len] == '/' || !cwd[len]))
+                {
+                    append_dystring(&prompt, '~');
+                    merge_dystring(&prompt, &cwd[len]);
+                }
+                else
+                    merge_dystring(&prompt, cwd);
+                break;
+            }
+            case 's':
+                snprintf(num, sizeof(num), "%d", exit_code(last_exit_status));
+                merge_dystring(&prompt, num);
+                break;
+            case 't':
+                if(last_job_wall > 0)
+                    append_duration(&prompt, last_job_wall);
+                break;
+            case 'l':
+                if(cached_load)
+                    merge_dystring(&prompt, cached_load);
+                break;
+            case 'g':
+                // a branch from another directory would be wrong, show nothing until fresh
+                if(cached_git && cached_cwd && !strcmp(cached_cwd, cwd))
+                    merge_dystring(&prompt, cached_git);
+                break;
+            case '%':
+                append_dystring(&prompt, '%');
+                break;
+            default:
+                append_dystring(&prompt, '%');
+                append_dystring(&prompt, *f);
+        }
+    }
+
+    return prompt.string;
+}
+
+/*
+ *  Ask the helper for fresh segments, then draw with what is cached
+ */
+
+const char *
+prompt_begin()
+{
+    const char *fmt = find_environ("PROMPT", 6);
+    char cwd[4096];
+
+    if(fmt && request_pipe[1] >= 0 && (strstr(fmt, "%g") || strstr(fmt, "%l")) &&
+       getcwd(cwd, sizeof(cwd)))
+    {
+        if(helper_pid < 0)
+            start_helper();
+
+        size_t len = strlen(cwd);
+        cwd[len] = '\n';
+        if(write(request_pipe[1], cwd, len + 1) < 0 && errno != EAGAIN)
+            perror("prompt helper");
+    }
+
+    return render();
+}
+
+/*
+ *  The helper answered: take its latest values and draw again
+ */
+
+const char *
+prompt_update()
+{
+    char buf[4096];
+    ssize_t n;
+    char *line, *nl;
+
+    while((n = read(result_pipe[0], buf, sizeof(buf))) > 0)
+        append_dystring_n(&result, buf, n);
+
+    line = result.string;
+    while((nl = strchr(line, '\n')))
+    {
+        char *git = strchr(line, '\t');
+        char *load = git ? strchr(git + 1, '\t') : NULL;
+
+        *nl = '\0';
+        if(load)
+        {
+            *git++ = '\0';
+            *load++ = '\0';
+            free(cached_cwd);
+            free(cached_git);
+            free(cached_load);
+            cached_cwd = strdup(line);
+            cached_git = strdup(git);
+            cached_load = strdup(load);
+        }
+        line = nl + 1;
+    }
+
+    char *rest = strdup(line);
+    free_dystring(&result);
+    merge_dystring(&result, rest);
+    free(rest);
+
+    return render();
+}
@@ -0,0 +1,28 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#include <sys/types.h>
+
+/*
+ *  $PROMPT, with % escapes:
+ *
+ *      %d  current directory, $HOME shown as ~
+ *      %s  exit status of the last job
+ *      %t  wall time of the last job
+ *      %l  1 minute load average
+ *      %g  git branch, followed by * when the worktree is dirty
+ *      %%  a single %
+ *
+ *  Without $PROMPT the prompt is "< ".
+ *
+ *  %g and %l come from a helper process, so a slow git status never sits
+ *  between two commands. The prompt is drawn right away with the last
+ *  values and drawn again when the helper answers on prompt_init's fd.
+ */
+
+int prompt_init();
+const char *prompt_begin();
+const char *prompt_update();
+int prompt_helper(pid_t pid);
+
+#endif
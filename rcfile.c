@@ -0,0 +1,364 @@
+#define _GNU_SOURCE
+#include "rcfile.h"
+#include "my_shell.h"
+#include "cache.h"
+#include "pathindex.h"
+#include "dynamicstring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RC_MAGIC "myshrc2" // bumped whenever what may be cached changes
+#define RC_MAX_WORDS 64
+
+/*
+ *  Snapshot layout: the header, then num_deps strings "NAME=value" (or
+ *  "NAME" for unset), then num_effects argvs, each a run of strings
+ *  ended by an empty one. An argv whose first word holds '=' is an
+ *  assignment, anything else a set or ulimit builtin.
+ */
+
+typedef struct RcSnapshot
+{
+    char magic[8];
+    uint64_t size; // of the rc
+    int64_t mtime_sec, mtime_nsec;
+    uint64_t ino;
+    uint64_t hash;
+    uint32_t num_deps;
+    uint32_t num_effects;
+} RcSnapshot;
+
+static int recording; // the rc is running
+static int cacheable; // and has done nothing a snapshot cannot replay
+static dyarray deps;
+static dystring effects;
+static uint32_t num_effects;
+
+void
+rc_lookup(const char *key, size_t len)
+{
+    if(!recording)
+        return;
+
+    for(int i = 0; i < deps.curr_size; i++)
+        if(!strncmp(deps.str[i], key, len) && !deps.str[i][len])
+            return;
+
+    char *name = strndup(key, len);
+    append_dyarray(&deps, name);
+    free(name);
+}
+
+void
+rc_assign(const char *envp)
+{
+    if(!recording)
+        return;
+
+    append_dystring_n(&effects, envp, strlen(envp) + 1);
+    append_dystring(&effects, '\0');
+    num_effects++;
+}
+
+/*
+ *  Only set and ulimit, and without redirections: the replay runs argv
+ *  alone, a set -o x 2>/dev/null would complain on the terminal
+ */
+
+void
+rc_builtin(process *p)
+{
+    char **argv = p->argv;
+    int i;
+
+    if(!recording)
+        return;
+
+    if((strcmp(argv[0], "set") && strcmp(argv[0], "ulimit")) || p->redirs)
+    {
+        cacheable = 0;
+        return;
+    }
+
+    for(i = 0; argv[i]; i++)
+        append_dystring_n(&effects, argv[i], strlen(argv[i]) + 1);
+    append_dystring(&effects, '\0');
+    num_effects++;
+
+    if(i >= RC_MAX_WORDS)
+        cacheable = 0;
+}
+
+void
+rc_job()
+{
+    if(recording)
+        cacheable = 0;
+}
+
+// a value from the running shell ($$, $?), a replay would repeat it
+void
+rc_volatile()
+{
+    if(recording)
+        cacheable = 0;
+}
+
+static int
+same_file(RcSnapshot *h, struct stat *st)
+{
+    return h->size == (uint64_t)st->st_size && h->ino == (uint64_t)st->st_ino &&
+           h->mtime_sec == st->st_mtim.tv_sec && h->mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+static int
+read_rc(const char *path, dystring *out)
+{
+    char buf[65536];
+    ssize_t n;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0)
+        return -1;
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+        append_dystring_n(out, buf, n);
+    close(fd);
+
+    return n < 0 ? -1 : 0;
+}
+
+/*
+ *  Replay the snapshot at snap if it still describes the rc. -1 when
+ *  the rc has to run.
+ */
+
+static int
+replay(const char *snap, const char *rc, struct stat *st)
+{
+    struct stat sst;
+    int fd = open(snap, O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0)
+        return -1;
+    if(fstat(fd, &sst) < 0 || (size_t)sst.st_size <= sizeof(RcSnapshot))
+    {
+        close(fd);
+        return -1;
+    }
+
+    size_t len = sst.st_size;
+    char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+
+    RcSnapshot *h = (RcSnapshot *)map;
+    const char *p = map + sizeof(RcSnapshot), *end = map + len;
+    int valid = !memcmp(h->magic, RC_MAGIC, sizeof(h->magic)) && end[-1] == '\0';
+
+    // touched but not changed is still a hit
+    if(valid && !same_file(h, st))
+    {
+        dystring text;
+        init_dystring(&text);
+        valid = read_rc(rc, &text) == 0 && cache_hash(text.string, text.curr_size) == h->hash;
+        free_dystring(&text);
+    }
+
+    for(uint32_t i = 0; valid && i < h->num_deps; i++)
+    {
+        if(p >= end)
+        {
+            valid = 0;
+            break;
+        }
+
+        size_t name = strcspn(p, "=");
+        const char *now = find_environ(p, name);
+
+        if(p[name] == '=' ? !now || strcmp(now, &p[name + 1]) : now != NULL)
+            valid = 0;
+        p += strlen(p) + 1;
+    }
+
+    // check that every effect is complete before running any
+    const char *first = p;
+    for(uint32_t i = 0; valid && i < h->num_effects; i++)
+    {
+        while(p < end && *p)
+            p += strlen(p) + 1;
+        if(p++ >= end)
+            valid = 0;
+    }
+
+    p = first;
+    for(uint32_t i = 0; valid && i < h->num_effects; i++)
+    {
+        char *argv[RC_MAX_WORDS + 1];
+        int argc = 0;
+
+        for(; *p; p += strlen(p) + 1)
+            if(argc < RC_MAX_WORDS)
+                argv[argc++] = (char *)p;
+        p++;
+        argv[argc] = NULL;
+
+        if(argc == 1 && strchr(argv[0], '='))
+        {
+            update_environ(argv[0]); // copies
+            if(!strncmp(argv[0], "PATH=", 5))
+                pathindex_set_path(argv[0] + 5);
+        }
+        else
+            call_builtin(argv);
+    }
+
+    munmap(map, len);
+    return valid ? 0 : -1;
+}
+
+static void
+save(const char *snap, struct stat *st, uint64_t hash)
+{
+    RcSnapshot h;
+    dystring out, tmp;
+    char suffix[32];
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, RC_MAGIC, sizeof(h.magic));
+    h.size = st->st_size;
+    h.mtime_sec = st->st_mtim.tv_sec;
+    h.mtime_nsec = st->st_mtim.tv_nsec;
+    h.ino = st->st_ino;
+    h.hash = hash;
+    h.num_deps = deps.curr_size;
+    h.num_effects = num_effects;
+
+    init_dystring(&out);
+    append_dystring_n(&out, (char *)&h, sizeof(h));
+    for(int i = 0; i < deps.curr_size; i++)
+    {
+        const char *value = getenv(deps.str[i]); // inherited, not as the rc left it
+
+        merge_dystring(&out, deps.str[i]);
+        if(value)
+        {
+            append_dystring(&out, '=');
+            merge_dystring(&out, value);
+        }
+        append_dystring(&out, '\0');
+    }
+    append_dystring_n(&out, effects.string, effects.curr_size);
+
+    init_dystring(&tmp);
+    merge_dystring(&tmp, snap);
+    snprintf(suffix, sizeof(suffix), ".tmp.%d", (int)getpid());
+    merge_dystring(&tmp, suffix);
+
+    int fd = open(tmp.string, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd >= 0)
+    {
+        if(write(fd, out.string, out.curr_size) != (ssize_t)out.curr_size || rename(tmp.string, snap) < 0)
+            unlink(tmp.string);
+        close(fd);
+    }
+
+    free_dystring(&tmp);
+    free_dystring(&out);
+}
+
+/*
+ *  Run the rc line by line, and save a snapshot when it allows one
+ */
+
+static void
+run(const char *rc, struct stat *st, const char *snap)
+{
+    dystring text;
+    char *line, *next;
+
+    init_dystring(&text);
+    if(read_rc(rc, &text) < 0)
+    {
+        perror(rc);
+        free_dystring(&text);
+        return;
+    }
+    uint64_t hash = cache_hash(text.string, text.curr_size);
+
+    init_dyarray(&deps);
+    init_dystring(&effects);
+    num_effects = 0;
+    cacheable = 1;
+    recording = 1;
+
+    for(line = text.string; line < text.string + text.curr_size; line = next)
+    {
+        char *nl = memchr(line, '\n', text.string + text.curr_size - line);
+
+        next = nl ? nl + 1 : text.string + text.curr_size;
+        if(nl)
+            *nl = '\0';
+        if(line[strspn(line, " \t")] && line[strspn(line, " \t")] != '#')
+            exec_sep(line);
+    }
+
+    recording = 0;
+    if(cacheable && snap)
+        save(snap, st, hash);
+
+    free_dyarray(&deps);
+    free_dystring(&effects);
+    free_dystring(&text);
+}
+
+void
+rc_load()
+{
+    const char *rc = find_environ("MYSHELLRC", 9);
+    const char *home = find_environ("HOME", 4);
+    dystring path, snap;
+    struct stat st;
+
+    if(rc && !rc[0])
+        return;
+
+    init_dystring(&path);
+    if(rc)
+        merge_dystring(&path, rc);
+    else if(home)
+    {
+        merge_dystring(&path, home);
+        merge_dystring(&path, "/.myshellrc");
+    }
+
+    if(path.curr_size == 0 || stat(path.string, &st) < 0)
+    {
+        free_dystring(&path);
+        return;
+    }
+
+    // one snapshot per rc path, found before the rc can move HOME
+    init_dystring(&snap);
+    int have_snap = cache_dir(&snap) == 0;
+    if(have_snap)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/rc-%016llx",
+                 (unsigned long long)cache_hash(path.string, path.curr_size));
+        merge_dystring(&snap, name);
+    }
+
+    if(!have_snap || replay(snap.string, path.string, &st) < 0)
+        run(path.string, &st, have_snap ? snap.string : NULL);
+
+    free_dystring(&snap);
+    free_dystring(&path);
+}
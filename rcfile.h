@@ -0,0 +1,32 @@
+#ifndef RCFILE_H
+#define RCFILE_H
+
+#include <stddef.h>
+#include "jobcontrol.h"
+
+/*
+ *  $MYSHELLRC, or ~/.myshellrc, run line by line at startup (an empty
+ *  MYSHELLRC skips it).
+ *
+ *  An rc file made only of NAME=value, set and ulimit lines leaves
+ *  nothing behind but variables and settings. After running such a file
+ *  the shell saves those results to a snapshot in the cache directory;
+ *  the next start maps the snapshot and replays them without reading or
+ *  parsing the rc at all. The snapshot holds the rc's size, mtime and
+ *  hash, and the inherited value of every variable the rc looked up, so
+ *  PATH=$HOME/bin:$PATH is run again under a different HOME or PATH.
+ *  An rc that runs anything else, expands $$ or $? (which no variable
+ *  lookup explains), or redirects a set or ulimit is simply run each
+ *  time.
+ */
+
+void rc_load();
+
+// exec_job, find_environ and expand report what the rc does while it runs
+void rc_assign(const char *envp);
+void rc_builtin(process *p);
+void rc_job();
+void rc_volatile();
+void rc_lookup(const char *key, size_t len);
+
+#endif
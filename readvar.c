@@ -0,0 +1,376 @@
+#define _GNU_SOURCE
+#include "readvar.h"
+#include "my_shell.h"
+#include "dynamicstring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define READ_BLOCK 65536
+#define READ_FIRST 128 // first block of a read on seekable input
+
+typedef struct ReadOpts
+{
+    int raw;   // -r
+    int strip; // -t
+    int delim; // -d, '\n' by default
+    int fd;    // -u
+} ReadOpts;
+
+/*
+ *  Options up to the first word that is not one. Returns the index of
+ *  the first name, -1 after a usage message.
+ */
+
+static int
+parse_opts(char **argv, const char *flags, ReadOpts *o)
+{
+    int i;
+
+    o->raw = o->strip = 0;
+    o->delim = '\n';
+    o->fd = STDIN_FILENO;
+
+    for(i = 1; argv[i] && argv[i][0] == '-' && argv[i][1]; i++)
+    {
+        char opt = argv[i][1];
+
+        if(argv[i][2] || !strchr(flags, opt))
+            return -1;
+        if(opt == 'r')
+            o->raw = 1;
+        else if(opt == 't')
+            o->strip = 1;
+        else if(!argv[++i])
+            return -1;
+        else if(opt == 'd')
+            o->delim = (unsigned char)argv[i][0]; // -d '' is NUL
+        else if(opt == 'u')
+        {
+            if(!isdigit(argv[i][0]))
+                return -1;
+            o->fd = atoi(argv[i]);
+        }
+    }
+
+    return i;
+}
+
+static int
+valid_name(const char *name)
+{
+    if(!isalpha(*name) && *name != '_')
+        return 0;
+    while(*++name)
+        if(!isalnum(*name) && *name != '_')
+            return 0;
+
+    return 1;
+}
+
+/*
+ *  The script itself is the shell's stdin, read through stdio: a read
+ *  from there has to take its lines from the same buffer.
+ */
+
+static int
+script_stdin(int fd)
+{
+    return fd == STDIN_FILENO && !shell_is_interactive && !builtin_redirected(STDIN_FILENO);
+}
+
+// the delimiter just reached is preceded by an odd run of backslashes
+static int
+escaped(dystring *ds, int raw)
+{
+    size_t n = 0;
+
+    while(!raw && n < ds->curr_size && ds->string[ds->curr_size - 1 - n] == '\\')
+        n++;
+
+    return n & 1;
+}
+
+/*
+ *  One record into out, without its delimiter. 1 if the delimiter was
+ *  found, 0 at end of input, -1 on error.
+ *
+ *  Seekable input is read in blocks and the offset put back just past
+ *  the delimiter, so the next reader starts at the next record. Blocks
+ *  start small and double while no delimiter turns up: a read costs
+ *  about its own line, a long line few reads. Pipes and terminals
+ *  cannot be put back: a byte at a time.
+ */
+
+static int
+read_record(ReadOpts *o, dystring *out)
+{
+    char buf[READ_BLOCK];
+    size_t want = READ_FIRST;
+    ssize_t n;
+    off_t off;
+
+    if(script_stdin(o->fd))
+    {
+        int c;
+
+        while((c = getchar()) != EOF)
+        {
+            if(c == o->delim && !escaped(out, o->raw))
+                return 1;
+            append_dystring(out, c);
+        }
+        return 0;
+    }
+
+    if((off = lseek(o->fd, 0, SEEK_CUR)) < 0)
+    {
+        char c;
+
+        while((n = read(o->fd, &c, 1)) > 0 || (n < 0 && errno == EINTR))
+        {
+            if(n < 0)
+                continue;
+            if(c == o->delim && !escaped(out, o->raw))
+                return 1;
+            append_dystring(out, c);
+        }
+        return n < 0 ? -1 : 0;
+    }
+
+    while((n = read(o->fd, buf, want)) > 0 || (n < 0 && errno == EINTR))
+    {
+        if(n < 0)
+            continue;
+
+        char *p = buf, *end = buf + n, *d;
+
+        while((d = memchr(p, o->delim, end - p)))
+        {
+            append_dystring_n(out, p, d - p);
+            if(!escaped(out, o->raw))
+            {
+                lseek(o->fd, off + (d + 1 - buf), SEEK_SET);
+                return 1;
+            }
+            append_dystring(out, o->delim);
+            p = d + 1;
+        }
+        append_dystring_n(out, p, end - p);
+        off += n;
+        if(want < sizeof(buf))
+            want *= 2;
+    }
+
+    return n < 0 ? -1 : 0;
+}
+
+/*
+ *  Split text on ifs into the names, the last one taking the rest.
+ *  Without raw, \c is c and backslash-newline disappears.
+ */
+
+static void
+assign(char **names, int num, const char *text, const char *ifs, int raw)
+{
+    dystring field;
+    size_t keep = 0; // field length without trailing separators
+    int v = 0;
+    const char *p = text;
+
+    while(*p && strchr(ifs, *p))
+        p++;
+    init_dystring(&field);
+
+    for(; *p; p++)
+    {
+        if(!raw && *p == '\\')
+        {
+            if(p[1] && p[1] != '\n')
+                append_dystring(&field, p[1]);
+            if(p[1])
+                p++;
+            keep = field.curr_size;
+            continue;
+        }
+
+        if(strchr(ifs, *p))
+        {
+            if(v < num - 1)
+            {
+                set_var(names[v++], field.string);
+                free_dystring(&field);
+                keep = 0;
+                while(p[1] && strchr(ifs, p[1]))
+                    p++;
+                continue;
+            }
+            append_dystring(&field, *p);
+            continue;
+        }
+
+        append_dystring(&field, *p);
+        keep = field.curr_size;
+    }
+
+    field.string[keep] = '\0';
+    set_var(names[v++], field.string);
+    for(; v < num; v++)
+        set_var(names[v], "");
+    free_dystring(&field);
+}
+
+int
+do_read(char **argv)
+{
+    static char *reply[] = {"REPLY", NULL};
+    ReadOpts o;
+    dystring line;
+    int first = parse_opts(argv, "rdu", &o);
+
+    if(first < 0)
+    {
+        fprintf(stderr, "usage: read [-r] [-d DELIM] [-u FD] [NAME...]\n");
+        return 2 << 8;
+    }
+    for(int i = first; argv[i]; i++)
+        if(!valid_name(argv[i]))
+        {
+            fprintf(stderr, "read: %s: not a variable name\n", argv[i]);
+            return 2 << 8;
+        }
+
+    init_dystring(&line);
+    int found = read_record(&o, &line);
+    if(found < 0)
+        perror("read");
+
+    const char *ifs = find_environ("IFS", 3);
+    int num = 0;
+    while(argv[first + num])
+        num++;
+    if(num)
+        assign(&argv[first], num, line.string, ifs ? ifs : " \t\n", o.raw);
+    else
+        assign(reply, 1, line.string, "", o.raw); // REPLY keeps the whole line
+    free_dystring(&line);
+
+    return found > 0 ? 0 : 1 << 8;
+}
+
+/*
+ *  The rest of the input in one go: a regular file is mapped, anything
+ *  else read in large blocks into data. Returns the bytes, NULL on error.
+ */
+
+static const char *
+slurp(int fd, dystring *data, size_t *len, void **map, size_t *map_len)
+{
+    char buf[READ_BLOCK];
+    struct stat st;
+    ssize_t n;
+    off_t off;
+
+    *map = NULL;
+    if(script_stdin(fd))
+    {
+        while((n = fread(buf, 1, sizeof(buf), stdin)) > 0)
+            append_dystring_n(data, buf, n);
+        *len = data->curr_size;
+        return data->string;
+    }
+
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (off = lseek(fd, 0, SEEK_CUR)) >= 0 &&
+       st.st_size > off)
+    {
+        void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(m != MAP_FAILED)
+        {
+            madvise(m, st.st_size, MADV_SEQUENTIAL);
+            lseek(fd, st.st_size, SEEK_SET);
+            *map = m;
+            *map_len = st.st_size;
+            *len = st.st_size - off;
+            return (char *)m + off;
+        }
+    }
+
+    while((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))
+        if(n > 0)
+            append_dystring_n(data, buf, n);
+    if(n < 0)
+        return NULL;
+
+    *len = data->curr_size;
+    return data->string;
+}
+
+int
+do_mapfile(char **argv)
+{
+    ReadOpts o;
+    dystring data, value;
+    char key[256], num[16];
+    void *map;
+    size_t len, map_len;
+    int count = 0;
+    int first = parse_opts(argv, "tdu", &o);
+    const char *name = first > 0 && argv[first] ? argv[first] : "MAPFILE";
+
+    if(first < 0 || (argv[first] && argv[first + 1]))
+    {
+        fprintf(stderr, "usage: %s [-t] [-d DELIM] [-u FD] [NAME]\n", argv[0]);
+        return 2 << 8;
+    }
+    if(!valid_name(name) || strlen(name) > sizeof(key) - 16)
+    {
+        fprintf(stderr, "%s: %s: not a variable name\n", argv[0], name);
+        return 2 << 8;
+    }
+
+    init_dystring(&data);
+    init_dystring(&value);
+    const char *text = slurp(o.fd, &data, &len, &map, &map_len);
+    if(text == NULL)
+    {
+        perror(argv[0]);
+        free_dystring(&data);
+        return 1 << 8;
+    }
+
+    for(const char *p = text, *end = text + len; p < end; count++)
+    {
+        const char *d = memchr(p, o.delim, end - p);
+        const char *next = d ? d + 1 : end;
+
+        append_dystring_n(&value, p, (o.strip && d ? d : next) - p);
+        snprintf(key, sizeof(key), "%s_%d", name, count);
+        set_var(key, value.string);
+        free_dystring(&value);
+        p = next;
+    }
+
+    // entries left from a longer earlier run
+    snprintf(key, sizeof(key), "%s_COUNT", name);
+    const char *old = find_environ(key, strlen(key));
+    for(int i = count, n = old ? atoi(old) : 0; i < n; i++)
+    {
+        snprintf(key, sizeof(key), "%s_%d", name, i);
+        set_var(key, NULL);
+    }
+
+    snprintf(key, sizeof(key), "%s_COUNT", name);
+    snprintf(num, sizeof(num), "%d", count);
+    set_var(key, num);
+
+    if(map)
+        munmap(map, map_len);
+    free_dystring(&data);
+
+    return 0;
+}
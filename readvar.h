@@ -0,0 +1,25 @@
+#ifndef READVAR_H
+#define READVAR_H
+
+/*
+ *  read [-r] [-d DELIM] [-u FD] [NAME...]
+ *
+ *  One line (up to DELIM) from FD, default 0, split on $IFS into the
+ *  NAMEs, the last one taking the rest; REPLY without names. Without -r
+ *  a backslash escapes the next character and joins lines. Status 1 at
+ *  end of input before DELIM.
+ *
+ *  mapfile [-t] [-d DELIM] [-u FD] [NAME], also readarray
+ *
+ *  Every line of FD into NAME_0, NAME_1... and their number into
+ *  NAME_COUNT (NAME is MAPFILE by default). -t drops the delimiter. A
+ *  regular file is mapped whole rather than read.
+ *
+ *  Both set shell variables (see set_var): not exported unless the name
+ *  already was.
+ */
+
+int do_read(char **argv);
+int do_mapfile(char **argv);
+
+#endif
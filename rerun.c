@@ -0,0 +1,368 @@
+#define _GNU_SOURCE
+#include "rerun.h"
+#include "my_shell.h"
+#include "jobcontrol.h"
+#include "dynamicstring.h"
+#include "sighandler.h"
+#include "deadline.h"
+#include "rlimits.h"
+#include "outbuf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#define RERUN_DEBOUNCE_MS 100
+#define RERUN_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE)
+
+/*
+ *  One per watch descriptor. A directory named on the command line (or
+ *  under one) counts every entry, the directory of a named file only
+ *  those names.
+ */
+
+typedef struct Watch
+{
+    char *dir;
+    char all;
+    dyarray names;
+} Watch;
+
+typedef struct Watches
+{
+    int fd;
+    Watch *w;   // indexed by watch descriptor
+    int len;
+} Watches;
+
+static volatile sig_atomic_t interrupted;
+
+static void
+rerun_interrupt(int sig)
+{
+    (void)sig;
+    interrupted = 1;
+}
+
+static Watch *
+add_watch(Watches *ws, const char *dir)
+{
+    int wd = inotify_add_watch(ws->fd, dir, RERUN_EVENTS);
+
+    if(wd < 0)
+    {
+        perror(dir);
+        return NULL;
+    }
+
+    if(wd >= ws->len)
+    {
+        ws->w = realloc(ws->w, sizeof(Watch) * (wd + 1));
+        memset(&ws->w[ws->len], 0, sizeof(Watch) * (wd + 1 - ws->len));
+        ws->len = wd + 1;
+    }
+
+    Watch *w = &ws->w[wd];
+    if(w->dir == NULL)
+    {
+        w->dir = strdup(dir);
+        init_dyarray(&w->names);
+    }
+
+    return w;
+}
+
+static int
+add_tree(Watches *ws, const char *dir)
+{
+    Watch *w = add_watch(ws, dir);
+    DIR *dp;
+    struct dirent *de;
+
+    if(w == NULL)
+        return -1;
+    w->all = 1;
+
+    if((dp = opendir(dir)) == NULL)
+        return 0;
+
+    while((de = readdir(dp)))
+    {
+        if(de->d_type != DT_DIR || de->d_name[0] == '.') // skips . .. .git
+            continue;
+
+        dystring sub;
+        init_dystring(&sub);
+        merge_dystring(&sub, dir);
+        append_dystring(&sub, '/');
+        merge_dystring(&sub, de->d_name);
+        add_tree(ws, sub.string);
+        free_dystring(&sub);
+    }
+    closedir(dp);
+
+    return 0;
+}
+
+static int
+add_path(Watches *ws, const char *path)
+{
+    struct stat st;
+
+    if(stat(path, &st) < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    if(S_ISDIR(st.st_mode))
+        return add_tree(ws, path);
+
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash == path ? 1 : slash - path) : strdup(".");
+    Watch *w = add_watch(ws, dir);
+
+    free(dir);
+    if(w == NULL)
+        return -1;
+    append_dyarray(&w->names, (char *)(slash ? slash + 1 : path));
+
+    return 0;
+}
+
+static void
+free_watches(Watches *ws)
+{
+    for(int i = 0; i < ws->len; i++)
+        if(ws->w[i].dir)
+        {
+            free(ws->w[i].dir);
+            free_dyarray(&ws->w[i].names);
+        }
+    free(ws->w);
+    close(ws->fd);
+}
+
+static int
+watched(Watch *w, const char *name)
+{
+    if(w->all)
+        return 1;
+
+    for(int i = 0; i < w->names.curr_size; i++)
+        if(!strcmp(w->names.str[i], name))
+            return 1;
+
+    return 0;
+}
+
+/*
+ *  Read what is queued, following new subdirectories. Returns the
+ *  number of events for watched paths.
+ */
+
+static int
+read_changes(Watches *ws)
+{
+    char buf[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    int changes = 0;
+
+    while((n = read(ws->fd, buf, sizeof(buf))) > 0)
+        for(char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+        {
+            struct inotify_event *ev = (struct inotify_event *)p;
+
+            if(ev->wd < 0 || ev->wd >= ws->len || ws->w[ev->wd].dir == NULL ||
+               !ev->len || !watched(&ws->w[ev->wd], ev->name))
+                continue;
+            changes++;
+
+            if((ev->mask & (IN_CREATE | IN_MOVED_TO)) && (ev->mask & IN_ISDIR) && ev->name[0] != '.')
+            {
+                dystring sub;
+                init_dystring(&sub);
+                merge_dystring(&sub, ws->w[ev->wd].dir);
+                append_dystring(&sub, '/');
+                merge_dystring(&sub, ev->name);
+                add_tree(ws, sub.string);
+                free_dystring(&sub);
+            }
+        }
+
+    return changes;
+}
+
+/*
+ *  Wait for the first change, -1 if interrupted. Deadlines of background
+ *  jobs are kept meanwhile.
+ */
+
+static int
+wait_change(Watches *ws)
+{
+    struct pollfd fds[2] = {{ws->fd, POLLIN, 0}, {deadline_fd(), POLLIN, 0}};
+
+    outbuf_flush_all();
+    while(!interrupted)
+    {
+        if(poll(fds, 2, -1) < 0)
+            continue; // EINTR, maybe ^C
+
+        if(fds[1].revents & POLLIN)
+            deadline_expire();
+        if((fds[0].revents & POLLIN) && read_changes(ws))
+            return 0;
+    }
+
+    return -1;
+}
+
+// until the paths have been quiet for RERUN_DEBOUNCE_MS
+static void
+settle(Watches *ws)
+{
+    struct pollfd fds = {ws->fd, POLLIN, 0};
+
+    while(!interrupted && poll(&fds, 1, RERUN_DEBOUNCE_MS) != 0)
+        read_changes(ws);
+}
+
+static void
+resume(job *j)
+{
+    sigprocmask(SIG_BLOCK, &mask_chld, &prev_chld);
+    if(shell_is_interactive)
+        put_job_in_foreground(j, 0);
+    else
+        wait_for_job(j);
+    sigprocmask(SIG_SETMASK, &prev_chld, NULL);
+}
+
+static job *
+cmd_job(char **cmd)
+{
+    job *j = new_job();
+    process *p = new_process();
+    dystring command;
+    int argc = 0;
+
+    while(cmd[argc])
+        argc++;
+    p->argv = malloc(sizeof(char *) * (argc + 1));
+    init_dystring(&command);
+    for(int i = 0; i < argc; i++)
+    {
+        p->argv[i] = strdup(cmd[i]);
+        if(i)
+            append_dystring(&command, ' ');
+        merge_dystring(&command, cmd[i]);
+    }
+    p->argv[argc] = NULL;
+    j->command = steal_dystring(&command);
+    j->first_process = p;
+
+    return j;
+}
+
+/*
+ *  One run of cmd. Returns its status, -1 when a change cancelled it and
+ *  it should run again, -2 when it could not start.
+ */
+
+static int
+run_once(Watches *ws, char **cmd)
+{
+    job *j = cmd_job(cmd);
+    int status;
+
+    if(limits_check(j) < 0 || deadline_check(j) < 0)
+    {
+        freejob(j);
+        return -2;
+    }
+
+    // wait_for_job comes back early on a change
+    wait_wake_fd = ws->fd;
+    launch_job(j, 1);
+    while(!job_is_completed(j) && !job_is_stopped(j) && !read_changes(ws))
+        resume(j);
+    wait_wake_fd = -1;
+
+    if(job_is_completed(j) || job_is_stopped(j))
+    {
+        status = j->timed_out ? 124 << 8 : j->status;
+        do_job_notification(); // a stopped job stays in the job list
+        return status;
+    }
+
+    settle(ws);
+    deadline_kill(j, SIGTERM);
+    resume(j);
+    do_job_notification();
+
+    return -1;
+}
+
+int
+do_rerun(char **argv)
+{
+    Watches ws = {-1, NULL, 0};
+    int sep, status = 0;
+
+    for(sep = 1; argv[sep] && strcmp(argv[sep], "--"); sep++){}
+    if(sep == 1 || !argv[sep] || !argv[sep + 1])
+    {
+        fprintf(stderr, "usage: rerun PATH... -- cmd args\n");
+        return 2 << 8;
+    }
+
+    ws.fd = shell_fd(inotify_init1(IN_CLOEXEC | IN_NONBLOCK));
+    if(ws.fd < 0)
+    {
+        perror("inotify");
+        return 1 << 8;
+    }
+
+    for(int i = 1; i < sep; i++)
+        if(add_path(&ws, argv[i]) < 0)
+        {
+            free_watches(&ws);
+            return 1 << 8;
+        }
+
+    interrupted = 0;
+    sighandler_t old = signal_wrapper(SIGINT, rerun_interrupt);
+
+    for(;;)
+    {
+        int res = run_once(&ws, &argv[sep + 1]);
+        if(res == -1 && !interrupted)
+            continue;
+        if(res == -1)
+            break;
+        if(res == -2)
+        {
+            status = 2 << 8;
+            break;
+        }
+        status = res;
+
+        // ^C reaches the job when it has the terminal, and ends rerun too
+        if(interrupted || (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) ||
+           WIFSTOPPED(status) || wait_change(&ws) < 0)
+            break;
+        settle(&ws);
+    }
+
+    signal_wrapper(SIGINT, old);
+    free_watches(&ws);
+
+    return status;
+}
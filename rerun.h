@@ -0,0 +1,16 @@
+#ifndef RERUN_H
+#define RERUN_H
+
+/*
+ *  rerun PATH... -- cmd args
+ *
+ *  Run cmd, then again each time something under the PATHs changes.
+ *  Directories are watched with their subdirectories (not the hidden
+ *  ones), files through their directory so editors that save by rename
+ *  are seen too. A burst of changes is one rerun, and a change while cmd
+ *  is still running cancels that run first. ^C stops.
+ */
+
+int do_rerun(char **argv);
+
+#endif
@@ -0,0 +1,312 @@
+#define _GNU_SOURCE
+#include "rlimits.h"
+#include "dynamicstring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+typedef struct Limit
+{
+    const char *name;
+    int resource;
+    char unit; // b: bytes, s: seconds, n: count
+} Limit;
+
+static Limit limit_names[] = {
+    {"mem",    RLIMIT_AS,     'b'},
+    {"cpu",    RLIMIT_CPU,    's'},
+    {"fsize",  RLIMIT_FSIZE,  'b'},
+    {"nofile", RLIMIT_NOFILE, 'n'},
+    {"nproc",  RLIMIT_NPROC,  'n'},
+    {"core",   RLIMIT_CORE,   'b'},
+    {"stack",  RLIMIT_STACK,  'b'},
+    {"data",   RLIMIT_DATA,   'b'},
+    {NULL, 0, 0}
+};
+
+#define NUM_LIMITS (sizeof(limit_names) / sizeof(limit_names[0]) - 1)
+
+static char *shell_limits[NUM_LIMITS]; // ulimit, as typed, NULL when not set
+
+// what the next child sets, worked out in the shell just before fork
+static rlim_t pending_value[NUM_LIMITS];
+static char pending_set[NUM_LIMITS];
+
+/*
+ *  "2G", "60s", "unlimited" into value, -1 if malformed
+ */
+
+static int
+parse_value(const Limit *l, const char *text, rlim_t *value)
+{
+    char *end;
+    unsigned long long n;
+
+    if(!strcmp(text, "unlimited"))
+    {
+        *value = RLIM_INFINITY;
+        return 0;
+    }
+
+    if(text[0] < '0' || text[0] > '9')
+        return -1;
+    n = strtoull(text, &end, 10);
+
+    if(l->unit == 'b' && *end)
+    {
+        const char *units = "KMGT";
+        const char *u = strchr(units, *end == 'k' ? 'K' : *end);
+        if(!u)
+            return -1;
+        n <<= 10 * (u - units + 1);
+        end++;
+    }
+    else if(l->unit == 's' && *end)
+    {
+        if(*end == 'm')
+            n *= 60;
+        else if(*end == 'h')
+            n *= 3600;
+        else if(*end != 's')
+            return -1;
+        end++;
+    }
+
+    if(*end)
+        return -1;
+
+    *value = n;
+    return 0;
+}
+
+/*
+ *  "cpu=60s": index of the limit and its value, -1 if either is wrong
+ */
+
+static int
+parse_setting(const char *setting, rlim_t *value)
+{
+    const char *eq = strchr(setting, '=');
+
+    if(eq == NULL)
+        return -1;
+
+    for(size_t i = 0; i < NUM_LIMITS; i++)
+        if(strlen(limit_names[i].name) == (size_t)(eq - setting) &&
+           !strncmp(limit_names[i].name, setting, eq - setting))
+            return parse_value(&limit_names[i], eq + 1, value) < 0 ? -1 : (int)i;
+
+    return -1;
+}
+
+int
+do_ulimit(char **argv)
+{
+    rlim_t value;
+
+    if(!argv[1] || !strcmp(argv[1], "-a"))
+    {
+        for(size_t i = 0; i < NUM_LIMITS; i++)
+            printf("%-8s %s\n", limit_names[i].name,
+                   shell_limits[i] ? strchr(shell_limits[i], '=') + 1 : "-");
+        return 0;
+    }
+
+    for(int a = 1; argv[a]; a++)
+        if(parse_setting(argv[a], &value) < 0)
+        {
+            fprintf(stderr, "ulimit: %s: expected name=value, see ulimit -a\n", argv[a]);
+            return 2 << 8;
+        }
+
+    for(int a = 1; argv[a]; a++)
+    {
+        int i = parse_setting(argv[a], &value);
+
+        free(shell_limits[i]);
+        shell_limits[i] = value == RLIM_INFINITY ? NULL : strdup(argv[a]);
+    }
+
+    return 0;
+}
+
+/*
+ *  j->limits holds the words after the limit keyword, separated by
+ *  spaces. Copies the next one into buf, 0 once there are none left.
+ */
+
+static int
+next_word(const char **s, char *buf, size_t size)
+{
+    size_t len;
+
+    *s += strspn(*s, " ");
+    len = strcspn(*s, " ");
+    if(len == 0)
+        return 0;
+
+    snprintf(buf, size, "%.*s", (int)len, *s);
+    *s += len;
+    return 1;
+}
+
+int
+limits_check(job *j)
+{
+    const char *s = j->limits;
+    char word[64];
+    rlim_t value;
+    int res = 0;
+
+    while(s && next_word(&s, word, sizeof(word)))
+        if(parse_setting(word, &value) < 0)
+        {
+            fprintf(stderr, "limit: %s: expected name=value, see ulimit -a\n", word);
+            res = -1;
+        }
+
+    return res;
+}
+
+/*
+ *  The words are also kept in j->limits_applied, so the job is reported
+ *  against the limits it ran under, not a ulimit typed since
+ */
+
+void
+limits_begin(job *j)
+{
+    const char *s = j->limits;
+    char word[64];
+    rlim_t value;
+    dystring applied;
+
+    init_dystring(&applied);
+    for(size_t i = 0; i < NUM_LIMITS; i++)
+    {
+        pending_set[i] = shell_limits[i] && parse_setting(shell_limits[i], &pending_value[i]) >= 0;
+        if(pending_set[i])
+        {
+            merge_dystring(&applied, shell_limits[i]);
+            append_dystring(&applied, ' ');
+        }
+    }
+    if(j->limits)
+        merge_dystring(&applied, j->limits);
+
+    free(j->limits_applied);
+    j->limits_applied = applied.curr_size ? steal_dystring(&applied) : NULL;
+    free_dystring(&applied);
+
+    while(s && next_word(&s, word, sizeof(word)))
+    {
+        int i = parse_setting(word, &value);
+        if(i >= 0)
+        {
+            pending_set[i] = 1;
+            pending_value[i] = value;
+        }
+    }
+}
+
+/*
+ *  In the child. A hard limit can only come down, so it is kept where it
+ *  is when already lower. cpu gets a second of grace past the soft
+ *  limit: SIGXCPU says which limit it was, the SIGKILL at the hard one
+ *  would not.
+ */
+
+void
+limits_apply()
+{
+    for(size_t i = 0; i < NUM_LIMITS; i++)
+    {
+        struct rlimit rl;
+        rlim_t value = pending_value[i];
+
+        if(!pending_set[i] || getrlimit(limit_names[i].resource, &rl) < 0)
+            continue;
+
+        rlim_t hard = value;
+        if(limit_names[i].resource == RLIMIT_CPU && value != RLIM_INFINITY)
+            hard = value + 1;
+        if(rl.rlim_max != RLIM_INFINITY && (hard == RLIM_INFINITY || hard > rl.rlim_max))
+            hard = rl.rlim_max;
+
+        rl.rlim_cur = value < hard ? value : hard;
+        rl.rlim_max = hard;
+        if(setrlimit(limit_names[i].resource, &rl) < 0)
+            perror(limit_names[i].name);
+    }
+}
+
+/*
+ *  The setting of resource (RLIMIT_CPU...) that was in force for j, or
+ *  NULL. A later word overrides an earlier one.
+ */
+
+static const char *
+limit_of(job *j, int resource)
+{
+    static char found[64];
+    const char *s = j->limits_applied;
+    char word[64];
+    rlim_t value, last = RLIM_INFINITY;
+
+    while(s && next_word(&s, word, sizeof(word)))
+    {
+        int i = parse_setting(word, &value);
+        if(i >= 0 && limit_names[i].resource == resource)
+        {
+            snprintf(found, sizeof(found), "%s", word);
+            last = value;
+        }
+    }
+
+    return last == RLIM_INFINITY ? NULL : found;
+}
+
+/*
+ *  The setting p most likely died on, or NULL. cpu and fsize are certain
+ *  from the signal, also when a shell in between exits with 128 + it.
+ *  Running out of mem only shows as a failed allocation, so it is
+ *  suspected when a process under a mem limit dies of SIGSEGV, SIGABRT
+ *  or SIGKILL (exit 139, 134 or 137 through a shell), never for a plain
+ *  non-zero exit.
+ */
+
+const char *
+limits_hit(job *j, process *p)
+{
+    static char buf[80];
+    const char *l;
+    int sig = 0;
+    rlim_t value;
+
+    if(!WIFSIGNALED(p->status) && WEXITSTATUS(p->status) == 0)
+        return NULL;
+
+    if(WIFSIGNALED(p->status))
+        sig = WTERMSIG(p->status);
+    else if(WEXITSTATUS(p->status) > 128)
+        sig = WEXITSTATUS(p->status) - 128;
+
+    if(sig == SIGXCPU && (l = limit_of(j, RLIMIT_CPU)))
+        return l;
+    if(sig == SIGKILL && (l = limit_of(j, RLIMIT_CPU)) && parse_setting(l, &value) >= 0 &&
+       (rlim_t)(p->rusage.ru_utime.tv_sec + p->rusage.ru_stime.tv_sec + 1) >= value)
+        return l;
+    if(sig == SIGXFSZ && (l = limit_of(j, RLIMIT_FSIZE)))
+        return l;
+
+    if((sig == SIGSEGV || sig == SIGABRT || sig == SIGKILL) && (l = limit_of(j, RLIMIT_AS)))
+    {
+        snprintf(buf, sizeof(buf), "%s, probably", l);
+        return buf;
+    }
+
+    return NULL;
+}
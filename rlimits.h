@@ -0,0 +1,28 @@
+#ifndef RLIMITS_H
+#define RLIMITS_H
+
+#include "jobcontrol.h"
+
+/*
+ *  Resource limits for the commands the shell starts, never for the
+ *  shell itself:
+ *
+ *      ulimit mem=2G cpu=60s      for every job from now on
+ *      ulimit cpu=unlimited       drop one again
+ *      limit mem=512M cmd | cmd2  for this job only, on top of ulimit
+ *
+ *  Names: mem (address space), cpu, fsize, nofile, nproc, core, stack,
+ *  data. Sizes take K, M, G, T, times s, m, h.
+ *
+ *  Like affinity, the shell works the job's limits out before forking
+ *  and the child sets them with setrlimit before exec. A process that
+ *  dies on one is reported with the limit it hit.
+ */
+
+int do_ulimit(char **argv);
+int limits_check(job *j);
+void limits_begin(job *j);
+void limits_apply();
+const char *limits_hit(job *j, process *p);
+
+#endif
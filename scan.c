@@ -0,0 +1,153 @@
+#include "scan.h"
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+/*
+ *  The vector loops read whole aligned blocks, which may run past the
+ *  NUL into bytes outside the string (never past the page). That is
+ *  what ASan would report, so they are not instrumented.
+ */
+
+#define NO_ASAN __attribute__((no_sanitize_address))
+
+const unsigned char scan_class[256] = {
+    ['\0'] = SCAN_SPECIAL,
+    ['\t'] = SCAN_SPACE, ['\n'] = SCAN_SPACE, ['\v'] = SCAN_SPACE, ['\f'] = SCAN_SPACE, ['\r'] = SCAN_SPACE, [' '] = SCAN_SPACE,
+    ['\''] = SCAN_SPECIAL, ['\"'] = SCAN_SPECIAL, ['('] = SCAN_SPECIAL, [')'] = SCAN_SPECIAL,
+    ['{'] = SCAN_SPECIAL, ['}'] = SCAN_SPECIAL, ['$'] = SCAN_SPECIAL, ['|'] = SCAN_SPECIAL,
+    ['&'] = SCAN_SPECIAL, [';'] = SCAN_SPECIAL, ['<'] = SCAN_SPECIAL, ['>'] = SCAN_SPECIAL,
+};
+
+#ifdef SCAN_X86
+
+/*
+ *  Special bytes as ranges: NUL, \t-\r, ' ', '"', '$', '&'-')', ';'-'<',
+ *  '>', '{'-'}'. in_range is the unsigned (v - lo) <= (hi - lo) test.
+ */
+
+#define IN_RANGE_128(v, lo, hi) \
+    ({ __m128i d_ = _mm_sub_epi8(v, _mm_set1_epi8(lo)); \
+       _mm_cmpeq_epi8(_mm_min_epu8(d_, _mm_set1_epi8((hi) - (lo))), d_); })
+
+NO_ASAN static inline unsigned
+match_sse2(__m128i v, int with_space)
+{
+    __m128i m = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\"')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('$')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+    m = _mm_or_si128(m, IN_RANGE_128(v, '&', ')'));
+    m = _mm_or_si128(m, IN_RANGE_128(v, ';', '<'));
+    m = _mm_or_si128(m, IN_RANGE_128(v, '{', '}'));
+
+    if(with_space)
+    {
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+        m = _mm_or_si128(m, IN_RANGE_128(v, '\t', '\r'));
+    }
+
+    return _mm_movemask_epi8(m);
+}
+
+NO_ASAN static const char *
+scan_sse2(const char *s, int with_space)
+{
+    uintptr_t off = (uintptr_t)s & 15;
+    const __m128i *p = (const __m128i *)(s - off);
+    unsigned mask = match_sse2(_mm_load_si128(p), with_space) >> off;
+
+    if(mask)
+        return s + __builtin_ctz(mask);
+
+    for(;;)
+    {
+        p++;
+        mask = match_sse2(_mm_load_si128(p), with_space);
+        if(mask)
+            return (const char *)p + __builtin_ctz(mask);
+    }
+}
+
+#define IN_RANGE_256(v, lo, hi) \
+    ({ __m256i d_ = _mm256_sub_epi8(v, _mm256_set1_epi8(lo)); \
+       _mm256_cmpeq_epi8(_mm256_min_epu8(d_, _mm256_set1_epi8((hi) - (lo))), d_); })
+
+__attribute__((target("avx2"))) NO_ASAN static inline unsigned
+match_avx2(__m256i v, int with_space)
+{
+    __m256i m = _mm256_cmpeq_epi8(v, _mm256_setzero_si256());
+
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\"')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('$')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')));
+    m = _mm256_or_si256(m, IN_RANGE_256(v, '&', ')'));
+    m = _mm256_or_si256(m, IN_RANGE_256(v, ';', '<'));
+    m = _mm256_or_si256(m, IN_RANGE_256(v, '{', '}'));
+
+    if(with_space)
+    {
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+        m = _mm256_or_si256(m, IN_RANGE_256(v, '\t', '\r'));
+    }
+
+    return (unsigned)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2"))) NO_ASAN static const char *
+scan_avx2(const char *s, int with_space)
+{
+    uintptr_t off = (uintptr_t)s & 31;
+    const __m256i *p = (const __m256i *)(s - off);
+    unsigned mask = match_avx2(_mm256_load_si256(p), with_space) >> off;
+
+    if(mask)
+        return s + __builtin_ctz(mask);
+
+    for(;;)
+    {
+        p++;
+        mask = match_avx2(_mm256_load_si256(p), with_space);
+        if(mask)
+            return (const char *)p + __builtin_ctz(mask);
+    }
+}
+
+static const char *(*scan_impl)(const char *, int) = scan_sse2;
+
+#else
+
+static const char *
+scan_scalar(const char *s, int with_space)
+{
+    unsigned char mask = with_space ? (SCAN_SPECIAL | SCAN_SPACE) : SCAN_SPECIAL;
+
+    while(!(scan_class[(unsigned char)*s] & mask))
+        s++;
+
+    return s;
+}
+
+static const char *(*scan_impl)(const char *, int) = scan_scalar;
+
+#endif
+
+const char *
+scan_block(const char *s, int with_space)
+{
+    return scan_impl(s, with_space);
+}
+
+void
+scan_init()
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        scan_impl = scan_avx2;
+#endif
+}
@@ -0,0 +1,34 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+/*
+ *  Vectorized search for the next byte the parser cares about: quotes,
+ *  parens, braces, $ | & ; < > and, when with_space is set, whitespace.
+ *  Returns a pointer to it, or to the terminating NUL.
+ *
+ *  SSE2 on x86 by default, AVX2 once scan_init has checked the CPU,
+ *  a table lookup elsewhere.
+ */
+
+#define SCAN_SPECIAL 1
+#define SCAN_SPACE   2
+
+extern const unsigned char scan_class[256];
+
+const char *scan_block(const char *s, int with_space);
+void scan_init();
+
+static inline const char *
+scan_special(const char *s, int with_space)
+{
+    unsigned char mask = with_space ? (SCAN_SPECIAL | SCAN_SPACE) : SCAN_SPECIAL;
+
+    // dense operators and short words never reach the vector loop
+    for(int i = 0; i < 4; i++)
+        if(scan_class[(unsigned char)s[i]] & mask)
+            return s + i;
+
+    return scan_block(s + 4, with_space);
+}
+
+#endif
@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "my_shell.h"
+#include "sighandler.h"
+#include "deadline.h"
+#include "outbuf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_REQUEST (1 << 20)
+#define MAX_FDS 3
+
+static int
+read_full(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while(len > 0)
+    {
+        n = read(fd, p, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ *  Length word and the fds in one recvmsg, the body after it
+ */
+
+static char *
+recv_request(int sock, uint32_t *len, int *fds, int *num_fds)
+{
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+    struct iovec iov = {len, sizeof(*len)};
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t n;
+    char *body;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    while((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR){}
+    if(n <= 0)
+        return NULL;
+
+    *num_fds = 0;
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            *num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * *num_fds);
+        }
+
+    // a short read of the length word itself
+    if(n < (ssize_t)sizeof(*len) && read_full(sock, (char *)len + n, sizeof(*len) - n) < 0)
+        return NULL;
+
+    if(*len == 0 || *len > MAX_REQUEST)
+        return NULL;
+
+    body = malloc(*len + 1);
+    if(read_full(sock, body, *len) < 0)
+    {
+        free(body);
+        return NULL;
+    }
+    body[*len] = '\0';
+
+    return body;
+}
+
+/*
+ *  In the forked child: become the requested process context, run the
+ *  command like a script line, send back $?
+ */
+
+static void
+serve(int sock)
+{
+    int fds[MAX_FDS];
+    int num_fds = 0;
+    uint32_t len;
+    char *body = recv_request(sock, &len, fds, &num_fds);
+    char *end, *cmd, *cwd;
+    int32_t status;
+
+    if(body == NULL)
+        exit(1);
+
+    end = body + len;
+    cmd = body;
+    cwd = cmd + strlen(cmd) + 1;
+    if(cwd < end && cwd[0])
+    {
+        if(chdir(cwd) < 0)
+            perror(cwd);
+        else
+        {
+            dystring pwd;
+            init_dystring(&pwd);
+            merge_dystring(&pwd, "PWD=");
+            merge_dystring(&pwd, cwd);
+            update_environ(pwd.string);
+            free_dystring(&pwd);
+        }
+    }
+
+    for(char *env = cwd < end ? cwd + strlen(cwd) + 1 : end; env < end; env += strlen(env) + 1)
+        if(strchr(env, '='))
+            update_environ(env);
+
+    int null = open("/dev/null", O_RDWR);
+    for(int i = 0; i < MAX_FDS; i++)
+    {
+        dup2(i < num_fds ? fds[i] : null, i);
+        if(i < num_fds && fds[i] > 2)
+            close(fds[i]);
+    }
+    if(null > 2)
+        close(null);
+
+    int res = exec_sep(cmd);
+    status = exit_code(res);
+
+    fflush(NULL);
+    outbuf_flush_all(); // the output before the status
+    if(write(sock, &status, sizeof(status)) < 0)
+        perror("server reply");
+    free(body);
+    exit(0);
+}
+
+int
+server_main(const char *path)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    int lsock, sock;
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return 1;
+    }
+
+    // a daemon reads no terminal, init_shell sees a script shell
+    int null = open("/dev/null", O_RDONLY);
+    dup2(null, STDIN_FILENO);
+    close(null);
+    init_shell();
+
+    lsock = shell_fd(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if(lsock < 0 || bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lsock, 128) < 0)
+    {
+        perror(path);
+        return 1;
+    }
+
+    // request children are not jobs, the kernel reaps them
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sa.sa_flags = SA_NOCLDWAIT;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+
+    for(;;)
+    {
+        sock = shell_fd(accept4(lsock, NULL, NULL, SOCK_CLOEXEC));
+        if(sock < 0)
+        {
+            if(errno != EINTR && errno != ECONNABORTED)
+                perror("accept");
+            continue;
+        }
+
+        pid_t pid = fork();
+        if(pid == 0)
+        {
+            close(lsock);
+            signal_wrapper(SIGCHLD, sigchld_handler); // the request's own jobs are
+            deadline_init();
+            serve(sock);
+        }
+        if(pid < 0)
+            perror("fork");
+        close(sock);
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/*
+ *  myshell --server SOCKET
+ *
+ *  Listen on a Unix stream socket and run every request in a child
+ *  forked from the already initialized shell. One request per
+ *  connection:
+ *
+ *      request  uint32_t len, then len bytes of NUL terminated strings:
+ *               command, cwd (empty to keep the server's), then any
+ *               number of NAME=value overrides.
+ *               Up to 3 fds may ride along as SCM_RIGHTS with the first
+ *               bytes, they become the command's stdin, stdout, stderr.
+ *               The ones not passed are /dev/null.
+ *
+ *      reply    int32_t status, the $? of the command
+ *
+ *  Integers are in host byte order, the socket never leaves the machine.
+ */
+
+int server_main(const char *path);
+
+#endif
@@ -0,0 +1,137 @@
+#define _DEFAULT_SOURCE
+#include "stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+static shell_stats_t local_stats;
+
+shell_stats_t *shell_stats = &local_stats; // usable before stats_init
+
+uint64_t
+stats_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+stats_init()
+{
+    shell_stats_t *shared = mmap(NULL, sizeof(shell_stats_t), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if(shared == MAP_FAILED)
+    {
+        perror("mmap (stats)");
+        return;
+    }
+
+    memcpy(shared, &local_stats, sizeof(shell_stats_t));
+    shell_stats = shared;
+    shell_stats->start_ns = stats_now();
+}
+
+void
+stats_record(stats_histogram *h, uint64_t ns)
+{
+    int bucket = 0;
+
+    while(bucket < STATS_BUCKETS - 1 && (ns >> (bucket + 1)))
+        bucket++;
+
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[bucket], 1, __ATOMIC_RELAXED);
+}
+
+/*
+ *  Human readable lower bound of a bucket
+ */
+
+static void
+format_ns(char *buf, size_t size, uint64_t ns)
+{
+    if(ns < 1000)
+        snprintf(buf, size, "%lluns", (unsigned long long)ns);
+    else if(ns < 1000000)
+        snprintf(buf, size, "%.1fus", ns / 1e3);
+    else if(ns < 1000000000)
+        snprintf(buf, size, "%.1fms", ns / 1e6);
+    else
+        snprintf(buf, size, "%.1fs", ns / 1e9);
+}
+
+static void
+print_histogram(const char *name, stats_histogram *h)
+{
+    char lo[32];
+
+    printf("%s: count %llu, mean %.1fus\n", name, (unsigned long long)h->count,
+           h->count ? h->sum_ns / 1e3 / h->count : 0.0);
+
+    for(int i = 0; i < STATS_BUCKETS; i++)
+    {
+        if(!h->buckets[i])
+            continue;
+
+        format_ns(lo, sizeof(lo), (uint64_t)1 << i);
+        printf("  >= %-8s %llu\n", lo, (unsigned long long)h->buckets[i]);
+    }
+}
+
+static void
+print_histogram_json(const char *name, stats_histogram *h)
+{
+    printf("\"%s\":{\"count\":%llu,\"sum_ns\":%llu,\"buckets\":[", name,
+           (unsigned long long)h->count, (unsigned long long)h->sum_ns);
+
+    for(int i = 0; i < STATS_BUCKETS; i++)
+        printf("%s%llu", i ? "," : "", (unsigned long long)h->buckets[i]);
+
+    printf("]}");
+}
+
+#define NUM_OF_COUNTERS 9
+
+void
+stats_print(int json)
+{
+    shell_stats_t *s = shell_stats;
+    struct { const char *name; uint64_t value; } counters[NUM_OF_COUNTERS] = {
+        {"lines_parsed", s->lines_parsed},
+        {"bytes_lexed",  s->bytes_lexed},
+        {"allocs",       s->allocs},
+        {"alloc_bytes",  s->alloc_bytes},
+        {"forks",        s->forks},
+        {"execs",        s->execs},
+        {"builtins",     s->builtins},
+        {"reaped",       s->reaped},
+        {"output_writes", s->output_writes},
+    };
+    double uptime = (stats_now() - s->start_ns) / 1e9;
+
+    if(json)
+    {
+        printf("{\"uptime_s\":%.3f", uptime);
+        for(int i = 0; i < NUM_OF_COUNTERS; i++)
+            printf(",\"%s\":%llu", counters[i].name, (unsigned long long)counters[i].value);
+        printf(",");
+        print_histogram_json("parse_ns", &s->parse);
+        printf(",");
+        print_histogram_json("fork_exec_ns", &s->fork_exec);
+        printf(",");
+        print_histogram_json("job_wall_ns", &s->job_wall);
+        printf("}\n");
+        return;
+    }
+
+    printf("uptime: %.3fs\n", uptime);
+    for(int i = 0; i < NUM_OF_COUNTERS; i++)
+        printf("%s: %llu\n", counters[i].name, (unsigned long long)counters[i].value);
+    print_histogram("parse latency", &s->parse);
+    print_histogram("fork to exec latency", &s->fork_exec);
+    print_histogram("job wall time", &s->job_wall);
+}
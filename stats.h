@@ -0,0 +1,48 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/*
+ *  Internal counters and latency histograms reported by shellstats.
+ *  They live in a shared anonymous mapping so forked children can
+ *  record their fork-to-exec latency before they exec.
+ */
+
+#define STATS_BUCKETS 40 // bucket k holds values in [2^k, 2^(k+1)) ns
+
+typedef struct stats_histogram
+{
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t buckets[STATS_BUCKETS];
+} stats_histogram;
+
+typedef struct shell_stats_t
+{
+    uint64_t start_ns;
+    uint64_t lines_parsed;
+    uint64_t bytes_lexed;
+    uint64_t allocs;
+    uint64_t alloc_bytes;
+    uint64_t forks;
+    uint64_t execs;
+    uint64_t builtins;
+    uint64_t reaped;
+    uint64_t output_writes;
+    stats_histogram parse;
+    stats_histogram fork_exec;
+    stats_histogram job_wall;
+} shell_stats_t;
+
+extern shell_stats_t *shell_stats;
+
+#define STAT_ADD(field, n) __atomic_fetch_add(&shell_stats->field, (n), __ATOMIC_RELAXED)
+#define STAT_INC(field) STAT_ADD(field, 1)
+
+void stats_init();
+uint64_t stats_now(); // CLOCK_MONOTONIC in ns, for stats and trace spans alike
+void stats_record(stats_histogram *h, uint64_t ns);
+void stats_print(int json);
+
+#endif
@@ -0,0 +1,17 @@
+X=a::b
+IFS=:
+printf "[%s]" $X
+echo
+Y=:a:b:
+printf "[%s]" $Y
+echo
+IFS=" :"
+Z=" a : b::c  "
+printf "[%s]" $Z
+echo
+printf "[%s]" pre$Y"post"
+echo
+IFS=" "
+W="  one   two  "
+printf "[%s]" $W
+echo
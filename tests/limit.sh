@@ -0,0 +1,14 @@
+limit fsize=1K sh -c "head -c 5000 /dev/zero > f"; echo limit=$?
+wc -c < f
+ulimit nofile=64
+sh -c "ulimit -n"
+limit nofile=32 sh -c "ulimit -n"
+ulimit nofile=unlimited fsize=2K
+ulimit -a
+sh -c "sleep 0.3; head -c 5000 /dev/zero > g" &
+ulimit fsize=unlimited
+wait
+wc -c < g
+ulimit fsize=1M cpu=x; echo bad=$?
+ulimit -a
+limit mem=1G false; echo mem=$?
@@ -0,0 +1,10 @@
+echo hi >a >b
+cat a b
+echo more >>a >c
+cat a c
+ulimit -a >d >e
+cmp d e && echo same
+printf x >f >>g | tr x y
+echo
+cat f g
+echo
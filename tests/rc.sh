@@ -0,0 +1,20 @@
+printf 'GREETING=hello$SUFFIX\nulimit nofile=100\nset -o pipestat\n' > rc
+printf 'echo $GREETING\nsh -c "ulimit -n"\n' > probe
+MYSHELLRC=rc $MYSHELL < probe
+sh -c "ls $XDG_CACHE_HOME/myshell | grep -c ^rc-"
+sh -c "sed -i s/hello/REPLAY/ $XDG_CACHE_HOME/myshell/rc-*"
+MYSHELLRC=rc $MYSHELL < probe
+touch rc
+MYSHELLRC=rc $MYSHELL < probe
+SUFFIX=-x MYSHELLRC=rc $MYSHELL < probe
+MYSHELLRC=rc $MYSHELL < probe
+printf 'GREETING=changed\nulimit nofile=50\n' > rc
+MYSHELLRC=rc $MYSHELL < probe
+printf 'ME=$$\n' > pid-rc
+printf 'sh -c "test $ME = $$ && echo same-pid"\n' > pid-probe
+MYSHELLRC=pid-rc $MYSHELL < pid-probe
+MYSHELLRC=pid-rc $MYSHELL < pid-probe
+printf 'GREETING=redirected\nset -o pipestat 2>/dev/null\n' > redir-rc
+printf 'echo $GREETING\n' > greet
+MYSHELLRC=redir-rc $MYSHELL < greet
+sh -c "ls $XDG_CACHE_HOME/myshell | grep -c ^rc-"
@@ -0,0 +1,16 @@
+printf "one two  three\nfour \\\nfive\nsix\\\\tseven\nlast" > in
+read A B < in; echo A=$A B=$B
+read < in; echo "REPLY=$REPLY"
+exec 3< in
+read -u 3 X; read -u 3 Y; read -u 3 -r Z; echo X=$X; echo Y=$Y; echo Z=$Z
+read -u 3 V; echo V=$V status=$?
+read -u 3 U; echo U=$U status=$?
+exec 3<&-
+mapfile -t L < in; echo count=$L_COUNT first=$L_0 last=$L_4
+printf "a\nb\n" > short
+mapfile -t L < short; echo count=$L_COUNT L_1=$L_1 L_2=${L_2:-unset}
+printf "x:y:z" > colon
+readarray -d : -t P < colon; echo $P_COUNT $P_0 $P_1 $P_2
+seq 1000 > nums
+exec 4< nums
+read -u 4 N1; read -u 4 N2; mapfile -t -u 4 R; echo $N1 $N2 $R_0 $R_COUNT
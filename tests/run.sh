@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+#  Regression run: every tests/NAME.sh is fed to myshell as a script, in
+#  a scratch directory of its own, and its stdout compared with
+#  tests/NAME.out. When tests/NAME.err exists, each of its lines has to
+#  turn up in a line of the shell's stderr, with job pids replaced by N.
+#
+#  usage: tests/run.sh [path/to/myshell] [NAME...]
+#
+
+MYSHELL=$(cd "$(dirname "${1:-./myshell}")" && pwd)/$(basename "${1:-./myshell}")
+TESTS=$(cd "$(dirname "$0")" && pwd)
+TMP=${TMPDIR:-/tmp}/myshell-tests.$$
+[ $# -gt 0 ] && shift
+
+mkdir -p "$TMP"
+trap 'rm -rf "$TMP"' EXIT
+
+# no rc of the user's, no cache entries from earlier runs
+MYSHELLRC=
+XDG_CACHE_HOME=$TMP/cache
+export MYSHELL MYSHELLRC XDG_CACHE_HOME
+
+# "1234 (completed): cmd" and "1234: Terminated by signal 9."
+normalize()
+{
+    sed -E 's/^[0-9]+ \(/N (/; s/^[0-9]+: /N: /'
+}
+
+names=$*
+[ -z "$names" ] && names=$(cd "$TESTS" && ls *.sh | grep -v '^run\.sh$' | sed 's/\.sh$//')
+
+pass=0
+fail=0
+for name in $names
+do
+    dir=$TMP/$name
+    mkdir -p "$dir"
+    (cd "$dir" && "$MYSHELL" < "$TESTS/$name.sh" > "$dir.stdout" 2> "$dir.stderr")
+    normalize < "$dir.stderr" > "$dir.stderr.n"
+
+    ok=1
+    if ! diff -u "$TESTS/$name.out" "$dir.stdout" > "$dir.diff"
+    then
+        ok=0
+        cat "$dir.diff"
+    fi
+    if [ -f "$TESTS/$name.err" ]
+    then
+        while IFS= read -r line
+        do
+            if ! grep -qF -- "$line" "$dir.stderr.n"
+            then
+                ok=0
+                echo "$name: stderr lacks: $line"
+            fi
+        done < "$TESTS/$name.err"
+    fi
+
+    if [ $ok = 1 ]
+    then
+        pass=$((pass + 1))
+        echo "ok   $name"
+    else
+        fail=$((fail + 1))
+        echo "FAIL $name"
+        sed 's/^/    stderr: /' "$dir.stderr.n"
+    fi
+done
+
+echo "$pass passed, $fail failed"
+[ $fail = 0 ]
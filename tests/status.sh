@@ -0,0 +1,19 @@
+false; set -o bogus; echo set=$?
+cd /nonexistent; echo cd=$?
+cd .; echo cd-ok=$?
+ulimit x; echo ulimit=$?
+set -o pipesize=nonsense; echo pipesize=$?
+set -o bgnice=3; echo bgnice=$?
+set +o bgnice
+false; echo after-false; echo echo=$?
+echo hi > /dev/full; echo full=$?
+echo hi > /dev/null; echo null=$?
+sh -c "exit 3"; echo sh=$?
+sh -c "exit 3" || echo or=$?
+true && false; echo and=$?
+read X < /dev/null; echo read-eof=$?
+mapfile -x; echo mapfile-usage=$?
+printf 'limit fsize=1K head -c 5000 /dev/zero > f\n' > killed
+MYSHELLRC= $MYSHELL < killed; echo script-killed=$?
+printf 'false\n' > failed
+MYSHELLRC= $MYSHELL < failed; echo script-failed=$?
@@ -0,0 +1,7 @@
+timeout 200ms sleep 5; echo timeout=$?
+timeout 5s true; echo fast=$?
+timeout 100ms --signal KILL sleep 5; echo kill=$?
+set -o jobtimeout=200ms
+set -o jobtimeout=bogus
+sleep 5; echo default=$?
+set +o jobtimeout
@@ -0,0 +1,148 @@
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+#include "my_shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define TRACE_BUFSIZE 4096
+
+typedef struct
+{
+    const char *name; // string literals only
+    const char *key;
+    long value;
+    uint64_t start;
+    uint64_t end;
+} trace_event;
+
+int trace_enabled = 0;
+
+static trace_event events[TRACE_BUFSIZE];
+static int num_events = 0;
+static int trace_fd = -1;
+static pid_t trace_owner = -1; // the shell that opened the file writes the trailer
+static int atexit_registered = 0;
+
+/*
+ *  Events are formatted into one chunk and written with O_APPEND, so
+ *  children writing their own spans never split an event in the middle.
+ */
+
+void
+trace_flush()
+{
+    char buf[65536];
+    size_t len = 0;
+    int pid = (int)getpid();
+
+    if(trace_fd < 0)
+        return;
+
+    for(int i = 0; i < num_events; i++)
+    {
+        trace_event *e = &events[i];
+        uint64_t dur = e->end - e->start;
+
+        len += snprintf(&buf[len], sizeof(buf) - len,
+                        "{\"name\":\"%s\",\"cat\":\"shell\",\"ph\":\"X\","
+                        "\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":%d,\"tid\":%d,"
+                        "\"args\":{\"%s\":%ld}},\n",
+                        e->name,
+                        (unsigned long long)(e->start / 1000), (unsigned)(e->start % 1000),
+                        (unsigned long long)(dur / 1000), (unsigned)(dur % 1000),
+                        pid, pid, e->key, e->value);
+
+        if(sizeof(buf) - len < 512 || i == num_events - 1)
+        {
+            if(write(trace_fd, buf, len) < 0)
+                perror("trace");
+            len = 0;
+        }
+    }
+
+    num_events = 0;
+}
+
+void
+trace_span(const char *name, uint64_t start, const char *key, long value)
+{
+    if(!start) // started before tracing was turned on
+        return;
+
+    if(num_events == TRACE_BUFSIZE)
+        trace_flush();
+
+    trace_event *e = &events[num_events++];
+    e->name = name;
+    e->key = key;
+    e->value = value;
+    e->start = start;
+    e->end = stats_now();
+}
+
+/*
+ *  A forked child inherits the unflushed spans of the shell. Drop them
+ *  so they are written only once, by the shell.
+ */
+
+void
+trace_after_fork()
+{
+    num_events = 0;
+}
+
+int
+trace_open(const char *path)
+{
+    int fd = shell_fd(open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644));
+
+    if(fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    trace_close();
+
+    if(write(fd, "[\n", 2) < 0)
+        perror("trace");
+
+    trace_fd = fd;
+    trace_owner = getpid();
+    trace_enabled = 1;
+
+    if(!atexit_registered)
+    {
+        atexit(trace_close);
+        atexit_registered = 1;
+    }
+
+    return 0;
+}
+
+void
+trace_close()
+{
+    char trailer[128];
+
+    if(trace_fd < 0)
+        return;
+
+    trace_flush();
+
+    if(getpid() == trace_owner)
+    {
+        int len = snprintf(trailer, sizeof(trailer),
+                           "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                           "\"args\":{\"name\":\"myshell\"}}]\n", (int)getpid());
+        if(write(trace_fd, trailer, len) < 0)
+            perror("trace");
+    }
+
+    close(trace_fd);
+    trace_fd = -1;
+    trace_enabled = 0;
+}
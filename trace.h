@@ -0,0 +1,27 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "stats.h"
+
+/*
+ *  Job lifecycle tracing in Chrome trace-event JSON (set -o trace=FILE).
+ *  Spans are kept in a buffer and written out when it fills up, before
+ *  exec, and when tracing stops. When tracing is off TRACE_START and
+ *  TRACE_END are a single branch on trace_enabled.
+ */
+
+extern int trace_enabled;
+
+int trace_open(const char *path);
+void trace_close();
+void trace_flush();
+void trace_after_fork();
+void trace_span(const char *name, uint64_t start, const char *key, long value);
+
+#define TRACE_START() (trace_enabled ? stats_now() : 0)
+#define TRACE_END(name, start, key, value) \
+    do { if(trace_enabled) trace_span(name, start, key, value); } while(0)
+
+#endif